@@ -0,0 +1,165 @@
+#ifndef BORDER_CROP_H
+#define BORDER_CROP_H
+
+// letterbox and pillarbox detection, the bars around the picture are left out of the networks
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// ncnn
+#include "mat.h"
+#include "platform.h"
+
+// source frames per window, the pairs of a window are cropped alike
+#define BORDER_CROP_WINDOW 240
+
+// frames sampled evenly from a window
+#define BORDER_CROP_SAMPLES 8
+
+static bool border_is_dark(const unsigned char* p, int n, int stride, int level)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const unsigned char* px = p + (size_t)i * stride;
+        if (px[0] > level || px[1] > level || px[2] > level)
+            return false;
+    }
+
+    return true;
+}
+
+// every channel of every pixel outside the area is at most level, w and h are 0 for a dark frame
+static void border_picture_area(const ncnn::Mat& image, int level, int* x, int* y, int* w, int* h)
+{
+    const int width = image.w;
+    const int height = image.h;
+    const int c = image.elempack;
+    const unsigned char* data = (const unsigned char*)image.data;
+
+    int top = 0;
+    while (top < height && border_is_dark(data + (size_t)top * width * c, width, c, level))
+        top++;
+
+    if (top == height)
+    {
+        *x = 0;
+        *y = 0;
+        *w = 0;
+        *h = 0;
+        return;
+    }
+
+    int bottom = height;
+    while (border_is_dark(data + (size_t)(bottom - 1) * width * c, width, c, level))
+        bottom--;
+
+    // columns within the rows left
+    const unsigned char* rows = data + (size_t)top * width * c;
+
+    int left = 0;
+    while (border_is_dark(rows + (size_t)left * c, bottom - top, width * c, level))
+        left++;
+
+    int right = width;
+    while (border_is_dark(rows + (size_t)(right - 1) * c, bottom - top, width * c, level))
+        right--;
+
+    *x = left;
+    *y = top;
+    *w = right - left;
+    *h = bottom - top;
+}
+
+// grows the area x0 y0 x1 y1 to the picture area of image, empty when x1 <= x0
+static void border_union(const ncnn::Mat& image, int level, int* area)
+{
+    int x, y, w, h;
+    border_picture_area(image, level, &x, &y, &w, &h);
+    if (w == 0)
+        return;
+
+    if (area[2] <= area[0])
+    {
+        area[0] = x;
+        area[1] = y;
+        area[2] = x + w;
+        area[3] = y + h;
+        return;
+    }
+
+    area[0] = std::min(area[0], x);
+    area[1] = std::min(area[1], y);
+    area[2] = std::max(area[2], x + w);
+    area[3] = std::max(area[3], y + h);
+}
+
+// picture area of the frames of one session. the area of a pair only depends on its source frames,
+// so shards, chunks and load threads crop it alike, and the samples of its window keep a dark scene
+// from shrinking it
+class BorderCrop
+{
+public:
+    BorderCrop()
+    {
+        level = -1;
+    }
+
+    // union of the picture areas of the samples of a window, false when not measured yet
+    bool window_area(int window, int* area)
+    {
+        lock.lock();
+
+        std::map<int, std::vector<int> >::const_iterator it = windows.find(window);
+        const bool found = it != windows.end();
+        if (found)
+            std::copy(it->second.begin(), it->second.end(), area);
+
+        lock.unlock();
+
+        return found;
+    }
+
+    void set_window_area(int window, const int* area)
+    {
+        lock.lock();
+        windows[window] = std::vector<int>(area, area + 4);
+        lock.unlock();
+    }
+
+    // area of a pair, covers the picture of both frames and window_area when not null,
+    // the whole frame when level is -1
+    void picture_area(const ncnn::Mat& in0image, const ncnn::Mat& in1image, const int* window_area, int* x, int* y, int* w, int* h) const
+    {
+        if (level < 0)
+        {
+            *x = 0;
+            *y = 0;
+            *w = in0image.w;
+            *h = in0image.h;
+            return;
+        }
+
+        int area[4] = { 0, 0, 0, 0 };
+        if (window_area)
+            std::copy(window_area, window_area + 4, area);
+
+        border_union(in0image, level, area);
+        border_union(in1image, level, area);
+
+        const bool empty = area[2] <= area[0];
+        *x = empty ? 0 : area[0];
+        *y = empty ? 0 : area[1];
+        *w = empty ? 0 : area[2] - area[0];
+        *h = empty ? 0 : area[3] - area[1];
+    }
+
+public:
+    // channel values counted as bar, -1 = no cropping
+    int level;
+
+private:
+    ncnn::Mutex lock;
+    std::map<int, std::vector<int> > windows;
+};
+
+#endif // BORDER_CROP_H
@@ -2,6 +2,8 @@
 
 #include "dain.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <algorithm>
 #include <vector>
 #include "benchmark.h"
@@ -20,6 +22,7 @@ DAIN::DAIN(int gpuid)
 {
     tilesize = 256;
     prepadding = 32;
+    static_tolerance = -1;
 
     vkdev = ncnn::get_gpu_device(gpuid);
     dain_preproc = 0;
@@ -165,7 +168,66 @@ int DAIN::load(const std::string& modeldir)
     return 0;
 }
 
+// no channel within the rectangle differs by more than tolerance between the frames
+static bool region_is_static(const unsigned char* pixel0data, const unsigned char* pixel1data, int w, int channels, int x0, int x1, int y0, int y1, int tolerance)
+{
+    const size_t size = (size_t)(x1 - x0) * channels;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const unsigned char* p0 = pixel0data + ((size_t)y * w + x0) * channels;
+        const unsigned char* p1 = pixel1data + ((size_t)y * w + x0) * channels;
+
+        if (tolerance == 0)
+        {
+            if (memcmp(p0, p1, size) != 0)
+                return false;
+
+            continue;
+        }
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (abs(p0[i] - p1[i]) > tolerance)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// output of a static region, the frames differ by noise at most there
+static void blend_region(const unsigned char* pixel0data, const unsigned char* pixel1data, unsigned char* outdata, int w, int channels, int x0, int x1, int y0, int y1, float timestep)
+{
+    const int weight1 = (int)(timestep * 256 + 0.5f);
+    const int weight0 = 256 - weight1;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const size_t offset = ((size_t)y * w + x0) * channels;
+        const unsigned char* p0 = pixel0data + offset;
+        const unsigned char* p1 = pixel1data + offset;
+        unsigned char* outptr = outdata + offset;
+
+        for (int i = 0; i < (x1 - x0) * channels; i++)
+        {
+            outptr[i] = (unsigned char)((p0[i] * weight0 + p1[i] * weight1 + 128) >> 8);
+        }
+    }
+}
+
 int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage) const
+{
+    DAINRows rows;
+    return process(in0image, in1image, timestep, outimage, rows);
+}
+
+int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage, DAINRows& rows) const
+{
+    return process(in0image, in1image, timestep, outimage, rows, 0, 0, in0image.w, in0image.h, static_tolerance);
+}
+
+int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage, DAINRows& rows, int area_x, int area_y, int area_w, int area_h, int static_tolerance) const
 {
     if (timestep == 0.f)
     {
@@ -181,6 +243,10 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
 
     if (tilesize == 0)
     {
+        // whole frame at once, nothing to share
+        if (rows.claim(in0image.h, in0image.h) < 0)
+            return 0;
+
         return process_notile(in0image, in1image, timestep, outimage);
     }
 
@@ -190,6 +256,15 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
     const int h = in0image.h;
     const int channels = 3;//in0image.elempack;
 
+    if (area_w <= 0 || area_h <= 0)
+    {
+        // no picture, the whole frame is bars
+        if (rows.claim(h, h) >= 0)
+            blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, 0, w, 0, h, timestep);
+
+        return 0;
+    }
+
     const int TILE_SIZE_X = tilesize;
     const int TILE_SIZE_Y = tilesize;
 
@@ -203,26 +278,62 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
-    // pad to 32n
-    int w_padded = (w + 31) / 32 * 32;
-    int h_padded = (h + 31) / 32 * 32;
+    // pad to 32n, tiles cover the picture area only
+    int w_padded = (area_w + 31) / 32 * 32;
+    int h_padded = (area_h + 31) / 32 * 32;
 
     // each tile 100x100
     const int xtiles = (w_padded + TILE_SIZE_X - 1) / TILE_SIZE_X;
-    const int ytiles = (h_padded + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
-//     fprintf(stderr, "tiles %d %d\n", xtiles, ytiles);
+//     fprintf(stderr, "tiles %d\n", xtiles);
 
     const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
 
-    //#pragma omp parallel for num_threads(2)
-    for (int yi = 0; yi < ytiles; yi++)
+    // rows of TILE_SIZE_Y, claimed one by one so that other gpus can share the frame
+    for (;;)
     {
-        int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
-        int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
+        const int band = rows.claim(TILE_SIZE_Y, area_h);
+        if (band < 0)
+            break;
+
+        const int row0 = area_y + band;
+
+        if (band == 0)
+        {
+            // bars above and below the picture
+            blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, 0, w, 0, area_y, timestep);
+            blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, 0, w, area_y + area_h, h, timestep);
+        }
+
+        int in_tile_y0 = std::max(row0 - prepadding, 0);
+        int in_tile_y1 = std::min(row0 + TILE_SIZE_Y + prepadding, h);
 
 //         fprintf(stderr, "in_tile_y0 %d %d\n", in_tile_y0, in_tile_y1);
 
+        int out_tile_y0 = row0;
+        int out_tile_y1 = std::min(row0 + TILE_SIZE_Y, area_y + area_h);
+
+        // tiles unchanged between the frames, halo included, skip the networks and are blended on the cpu
+        std::vector<char> tile_static(xtiles, 0);
+        int static_count = 0;
+        if (static_tolerance >= 0)
+        {
+            for (int xi = 0; xi < xtiles; xi++)
+            {
+                int x0 = std::max(area_x + xi * TILE_SIZE_X - prepadding, 0);
+                int x1 = std::min(area_x + (xi + 1) * TILE_SIZE_X + prepadding, w);
+
+                tile_static[xi] = region_is_static(pixel0data, pixel1data, w, channels, x0, x1, in_tile_y0, in_tile_y1, static_tolerance);
+                static_count += tile_static[xi];
+            }
+        }
+
+        if (static_count == xtiles)
+        {
+            blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, 0, w, out_tile_y0, out_tile_y1, timestep);
+            continue;
+        }
+
         ncnn::Mat in0;
         ncnn::Mat in1;
         if (opt.use_fp16_storage && opt.use_int8_storage)
@@ -257,9 +368,6 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
             }
         }
 
-        int out_tile_y0 = yi * TILE_SIZE_Y;
-        int out_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h);
-
         ncnn::VkMat out_gpu;
         if (opt.use_fp16_storage && opt.use_int8_storage)
         {
@@ -272,6 +380,9 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
 
         for (int xi = 0; xi < xtiles; xi++)
         {
+            if (tile_static[xi])
+                continue;
+
             // preproc
             ncnn::VkMat in0_tile_gpu;
             ncnn::VkMat in1_tile_gpu;
@@ -279,8 +390,8 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
                 // crop tile
                 int tile_x0 = xi * TILE_SIZE_X - prepadding;
                 int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w_padded) + prepadding;
-                int tile_y0 = yi * TILE_SIZE_Y - prepadding;
-                int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h_padded) + prepadding;
+                int tile_y0 = row0 - prepadding;
+                int tile_y1 = std::min(row0 + TILE_SIZE_Y, area_y + h_padded) + prepadding;
 
                 in0_tile_gpu.create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
 
@@ -296,8 +407,8 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
                 constants[4].i = in0_tile_gpu.h;
                 constants[5].i = in0_tile_gpu.cstep;
                 constants[6].i = prepadding;
-                constants[7].i = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                constants[8].i = xi * TILE_SIZE_X;
+                constants[7].i = std::max(prepadding - row0, 0);
+                constants[8].i = area_x + xi * TILE_SIZE_X;
 
                 cmd.record_pipeline(dain_preproc, bindings, constants, in0_tile_gpu);
             }
@@ -305,8 +416,8 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
                 // crop tile
                 int tile_x0 = xi * TILE_SIZE_X - prepadding;
                 int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w_padded) + prepadding;
-                int tile_y0 = yi * TILE_SIZE_Y - prepadding;
-                int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h_padded) + prepadding;
+                int tile_y0 = row0 - prepadding;
+                int tile_y1 = std::min(row0 + TILE_SIZE_Y, area_y + h_padded) + prepadding;
 
                 in1_tile_gpu.create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
 
@@ -322,8 +433,8 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
                 constants[4].i = in1_tile_gpu.h;
                 constants[5].i = in1_tile_gpu.cstep;
                 constants[6].i = prepadding;
-                constants[7].i = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                constants[8].i = xi * TILE_SIZE_X;
+                constants[7].i = std::max(prepadding - row0, 0);
+                constants[8].i = area_x + xi * TILE_SIZE_X;
 
                 cmd.record_pipeline(dain_preproc, bindings, constants, in1_tile_gpu);
             }
@@ -452,10 +563,10 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
                 constants[5].i = out_gpu.cstep;
                 constants[6].i = prepadding;
                 constants[7].i = prepadding;
-                constants[8].i = xi * TILE_SIZE_X;
+                constants[8].i = area_x + xi * TILE_SIZE_X;
 
                 ncnn::VkMat dispatcher;
-                dispatcher.w = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+                dispatcher.w = std::min((xi + 1) * TILE_SIZE_X, area_w) - xi * TILE_SIZE_X;
                 dispatcher.h = out_gpu.h;
                 dispatcher.c = 3;
 
@@ -468,7 +579,7 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
                 cmd.reset();
             }
 
-//             fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
+//             fprintf(stderr, "%.2f%%\n", (float)(row0 * xtiles + xi * TILE_SIZE_Y) / (h * xtiles) * 100);
         }
 
         // download
@@ -493,6 +604,21 @@ int DAIN::process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float ti
 #endif
             }
         }
+
+        // static tiles and the bars left and right of the picture were left out of out_gpu
+        for (int xi = 0; xi < xtiles && static_count > 0; xi++)
+        {
+            if (!tile_static[xi])
+                continue;
+
+            int x0 = area_x + xi * TILE_SIZE_X;
+            int x1 = area_x + std::min((xi + 1) * TILE_SIZE_X, area_w);
+
+            blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, x0, x1, out_tile_y0, out_tile_y1, timestep);
+        }
+
+        blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, 0, area_x, out_tile_y0, out_tile_y1, timestep);
+        blend_region(pixel0data, pixel1data, (unsigned char*)outimage.data, w, channels, area_x + area_w, w, out_tile_y0, out_tile_y1, timestep);
     }
 
     vkdev->reclaim_blob_allocator(blob_vkallocator);
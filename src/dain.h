@@ -7,6 +7,39 @@
 
 // ncnn
 #include "net.h"
+#include "platform.h"
+
+// output rows of one frame handed out in bands, shared by the DAIN instances
+// splitting that frame so that faster gpus take more bands
+class DAINRows
+{
+public:
+    DAINRows()
+    {
+        next = 0;
+    }
+
+    // first row of a band of the given height, -1 once all h rows are taken
+    int claim(int band, int h)
+    {
+        lock.lock();
+
+        int row0 = -1;
+        if (next < h)
+        {
+            row0 = next;
+            next += band;
+        }
+
+        lock.unlock();
+
+        return row0;
+    }
+
+private:
+    ncnn::Mutex lock;
+    int next;
+};
 
 class DAIN
 {
@@ -22,6 +55,13 @@ public:
 
     int process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage) const;
 
+    // processes the bands claimed from rows, several instances may share rows
+    int process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage, DAINRows& rows) const;
+
+    // only the area runs through the networks, the bars around it are blended,
+    // tiles differing by at most static_tolerance between the frames are blended too, -1 = never
+    int process(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage, DAINRows& rows, int area_x, int area_y, int area_w, int area_h, int static_tolerance) const;
+
     int process_notile(const ncnn::Mat& in0image, const ncnn::Mat& in1image, float timestep, ncnn::Mat& outimage) const;
 
 public:
@@ -29,6 +69,9 @@ public:
     int tilesize;
     int prepadding;
 
+    // static_tolerance of the shorter process calls
+    int static_tolerance;
+
 private:
     ncnn::VulkanDevice* vkdev;
     ncnn::Net depthnet;
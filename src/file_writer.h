@@ -0,0 +1,388 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+// asynchronous writer for encoded images, with io_uring or a thread pool
+#include <stdio.h>
+#include <queue>
+#include <vector>
+
+#if USE_IO_URING
+#include <liburing.h>
+#endif
+
+#if _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// ncnn
+#include "platform.h"
+
+#include "filesystem_utils.h"
+
+// encoded files waiting to be written, the save threads block beyond this
+#define FILE_WRITER_MAX_PENDING 32
+
+// io_uring submission batch
+#define FILE_WRITER_BATCH 16
+
+class FileWriter
+{
+public:
+    FileWriter()
+    {
+        finished = false;
+        failed = 0;
+        log = stderr;
+#if USE_IO_URING
+        use_ring = false;
+#endif
+    }
+
+    ~FileWriter()
+    {
+        finish();
+    }
+
+    // start the io_uring submitter, or thread_count blocking writers when io_uring is unavailable
+    void start(int thread_count)
+    {
+#if USE_IO_URING
+        use_ring = io_uring_queue_init(FILE_WRITER_BATCH * 2, &ring, 0) == 0;
+        if (use_ring)
+        {
+            threads.push_back(new ncnn::Thread(ring_writer, (void*)this));
+            return;
+        }
+#endif
+
+        for (int i = 0; i < thread_count; i++)
+        {
+            threads.push_back(new ncnn::Thread(blocking_writer, (void*)this));
+        }
+    }
+
+    // takes over the content of data, done is printed to log once the file is in place
+    void write(const path_t& path, std::vector<unsigned char>& data, const path_t& done)
+    {
+        Request* r = new Request;
+        r->path = path;
+        r->done = done;
+        r->data.swap(data);
+        r->written = 0;
+        r->fd = -1;
+        r->syncing = false;
+        r->closing = false;
+        r->failed = false;
+
+        lock.lock();
+
+        while (pending.size() >= FILE_WRITER_MAX_PENDING)
+        {
+            condition.wait(lock);
+        }
+
+        pending.push(r);
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    // flush everything and stop the writer threads
+    void finish()
+    {
+        lock.lock();
+        finished = true;
+        lock.unlock();
+
+        condition.broadcast();
+
+        for (size_t i = 0; i < threads.size(); i++)
+        {
+            threads[i]->join();
+            delete threads[i];
+        }
+        threads.clear();
+
+#if USE_IO_URING
+        if (use_ring)
+        {
+            io_uring_queue_exit(&ring);
+            use_ring = false;
+        }
+#endif
+    }
+
+    // files that could not be written, final after finish
+    int failures()
+    {
+        lock.lock();
+        const int n = failed;
+        lock.unlock();
+
+        return n;
+    }
+
+public:
+    // progress and write errors
+    FILE* log;
+
+private:
+    struct Request
+    {
+        path_t path;
+        path_t done;
+        std::vector<unsigned char> data;
+        size_t written;
+        int fd;
+        bool syncing;
+        bool closing;
+        bool failed;
+    };
+
+    // returns 0 once finished and drained
+    Request* next_request(bool block)
+    {
+        lock.lock();
+
+        while (block && pending.empty() && !finished)
+        {
+            condition.wait(lock);
+        }
+
+        Request* r = 0;
+        if (!pending.empty())
+        {
+            r = pending.front();
+            pending.pop();
+        }
+
+        lock.unlock();
+
+        if (r)
+            condition.broadcast();
+
+        return r;
+    }
+
+    // move the complete file to its final name, or drop the partial one
+    void complete(const Request* r)
+    {
+        const path_t tmppath = temp_filepath(r->path);
+
+        if (r->failed || rename_file(tmppath, r->path) != 0)
+        {
+            remove_file(tmppath);
+            report_error(r);
+            return;
+        }
+
+        if (!r->done.empty())
+        {
+#if _WIN32
+            fputws(r->done.c_str(), log);
+#else
+            fputs(r->done.c_str(), log);
+#endif
+        }
+    }
+
+    void report_error(const Request* r)
+    {
+        lock.lock();
+        failed++;
+        lock.unlock();
+
+#if _WIN32
+        fwprintf(log, L"write %ls failed\n", r->path.c_str());
+#else
+        fprintf(log, "write %s failed\n", r->path.c_str());
+#endif
+    }
+
+    static void* blocking_writer(void* args)
+    {
+        FileWriter* fw = (FileWriter*)args;
+
+        for (;;)
+        {
+            Request* r = fw->next_request(true);
+            if (!r)
+                break;
+
+            const path_t tmppath = temp_filepath(r->path);
+#if _WIN32
+            FILE* fp = _wfopen(tmppath.c_str(), L"wb");
+#else
+            FILE* fp = fopen(tmppath.c_str(), "wb");
+#endif
+            if (!fp || fwrite(r->data.data(), 1, r->data.size(), fp) != r->data.size())
+            {
+                r->failed = true;
+            }
+
+            // on disk before the rename, a renamed output is trusted by resume
+#if _WIN32
+            if (fp && !r->failed && (fflush(fp) != 0 || _commit(_fileno(fp)) != 0))
+#else
+            if (fp && !r->failed && (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+#endif
+            {
+                r->failed = true;
+            }
+
+            if (fp && fclose(fp) != 0)
+            {
+                r->failed = true;
+            }
+
+            fw->complete(r);
+
+            delete r;
+        }
+
+        return 0;
+    }
+
+#if USE_IO_URING
+    static void* ring_writer(void* args)
+    {
+        FileWriter* fw = (FileWriter*)args;
+        struct io_uring* ring = &fw->ring;
+
+        // requests with a write or close in flight
+        int inflight = 0;
+
+        for (;;)
+        {
+            // open new files and queue their writes, blocking only when idle
+            int queued = 0;
+            while (inflight + queued < FILE_WRITER_BATCH)
+            {
+                Request* r = fw->next_request(inflight + queued == 0);
+                if (!r)
+                    break;
+
+                r->fd = open(temp_filepath(r->path).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (r->fd < 0)
+                {
+                    fw->report_error(r);
+                    delete r;
+                    continue;
+                }
+
+                struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+                io_uring_prep_write(sqe, r->fd, r->data.data(), r->data.size(), 0);
+                io_uring_sqe_set_data(sqe, r);
+                queued++;
+            }
+
+            inflight += queued;
+
+            if (inflight == 0)
+                break;
+
+            io_uring_submit(ring);
+
+            struct io_uring_cqe* cqe = 0;
+            if (io_uring_wait_cqe(ring, &cqe) != 0)
+                continue;
+
+            // reap every completion available, a finished write turns into a close
+            int reaped = 0;
+            do
+            {
+                Request* r = (Request*)io_uring_cqe_get_data(cqe);
+                const int res = cqe->res;
+                io_uring_cqe_seen(ring, cqe);
+                reaped++;
+
+                if (r->closing)
+                {
+                    // close done, kernels without IORING_OP_CLOSE reject it with EINVAL and the fd is
+                    // still open. any other error has released the fd already, another thread may own it now
+                    if (res == -EINVAL)
+                    {
+                        if (close(r->fd) != 0)
+                            r->failed = true;
+                    }
+                    else if (res < 0)
+                    {
+                        r->failed = true;
+                    }
+
+                    fw->complete(r);
+
+                    delete r;
+                    inflight--;
+                    continue;
+                }
+
+                if (r->syncing)
+                {
+                    r->syncing = false;
+                    if (res < 0)
+                        r->failed = true;
+
+                    struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+                    io_uring_prep_close(sqe, r->fd);
+                    io_uring_sqe_set_data(sqe, r);
+                    r->closing = true;
+                    continue;
+                }
+
+                if (res <= 0)
+                {
+                    r->failed = true;
+                    r->written = r->data.size();
+                }
+                else
+                {
+                    r->written += res;
+                }
+
+                struct io_uring_sqe* sqe = io_uring_get_sqe(ring);
+                if (r->written < r->data.size())
+                {
+                    // short write, continue from where it stopped
+                    io_uring_prep_write(sqe, r->fd, r->data.data() + r->written, r->data.size() - r->written, r->written);
+                }
+                else if (!r->failed)
+                {
+                    // on disk before the rename, a renamed output is trusted by resume
+                    io_uring_prep_fsync(sqe, r->fd, 0);
+                    r->syncing = true;
+                }
+                else
+                {
+                    io_uring_prep_close(sqe, r->fd);
+                    r->closing = true;
+                }
+                io_uring_sqe_set_data(sqe, r);
+
+            } while (reaped < FILE_WRITER_BATCH && io_uring_peek_cqe(ring, &cqe) == 0);
+        }
+
+        return 0;
+    }
+#endif // USE_IO_URING
+
+private:
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::queue<Request*> pending;
+    bool finished;
+    int failed;
+    std::vector<ncnn::Thread*> threads;
+
+#if USE_IO_URING
+    bool use_ring;
+    struct io_uring ring;
+#endif
+};
+
+#endif // FILE_WRITER_H
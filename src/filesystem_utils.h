@@ -8,14 +8,23 @@
 
 #if _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
 #include "win32dirent.h"
 #else // _WIN32
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
 #endif // _WIN32
 
+#if __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 #if __APPLE__
 #include <mach-o/dyld.h>
 #endif
@@ -164,6 +173,230 @@ static bool filepath_is_readable(const path_t& path)
     return true;
 }
 
+#if !_WIN32
+// map the whole file read-only, the pages are shared with the page cache and never copied
+static unsigned char* map_file(const path_t& path, size_t* length)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat s;
+    if (fstat(fd, &s) != 0 || s.st_size <= 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return 0;
+
+    madvise(data, s.st_size, MADV_SEQUENTIAL);
+
+    *length = s.st_size;
+    return (unsigned char*)data;
+}
+
+static void unmap_file(unsigned char* data, size_t length)
+{
+    munmap(data, length);
+}
+
+// ask the kernel to start reading the file in background
+static void prefetch_file(const path_t& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+#if __APPLE__
+    struct radvisory ra;
+    ra.ra_offset = 0;
+    ra.ra_count = 64 * 1024 * 1024;
+    fcntl(fd, F_RDADVISE, &ra);
+#else
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+    close(fd);
+}
+#endif // _WIN32
+
+static int read_file(const path_t& path, std::vector<unsigned char>& data)
+{
+#if _WIN32
+    FILE* fp = _wfopen(path.c_str(), L"rb");
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+#endif
+    if (!fp)
+        return -1;
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    rewind(fp);
+
+    data.resize(length > 0 ? length : 0);
+    size_t nread = data.empty() ? 0 : fread(data.data(), 1, data.size(), fp);
+
+    fclose(fp);
+
+    return length > 0 && nread == data.size() ? 0 : -1;
+}
+
+// outputs are written under this name and renamed once complete, so a file
+// with the final name is never a partial write
+static path_t temp_filepath(const path_t& path)
+{
+    return path + PATHSTR(".part");
+}
+
+static int rename_file(const path_t& src, const path_t& dst)
+{
+#if _WIN32
+    return MoveFileExW(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(src.c_str(), dst.c_str());
+#endif
+}
+
+// flush a file written by someone else to disk, before it is renamed into place
+static int sync_file(const path_t& path)
+{
+#if _WIN32
+    int fd = _wopen(path.c_str(), _O_WRONLY | _O_BINARY);
+    if (fd < 0)
+        return -1;
+
+    int ret = _commit(fd);
+    _close(fd);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    int ret = fsync(fd);
+    close(fd);
+#endif
+    return ret;
+}
+
+// make the renames into a directory durable, ntfs journals them already
+static void sync_directory(const path_t& dirpath)
+{
+#if !_WIN32
+    int fd = open(dirpath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    fsync(fd);
+    close(fd);
+#else
+    (void)dirpath;
+#endif
+}
+
+static void remove_file(const path_t& path)
+{
+#if _WIN32
+    _wremove(path.c_str());
+#else
+    remove(path.c_str());
+#endif
+}
+
+// hardlink dst to src, or reflink or copy when the filesystem cannot link them
+#if _WIN32
+static int link_file(const path_t& src, const path_t& dst)
+{
+    DeleteFileW(dst.c_str());
+
+    if (CreateHardLinkW(dst.c_str(), src.c_str(), NULL))
+        return 0;
+
+    const path_t tmppath = temp_filepath(dst);
+    if (!CopyFileW(src.c_str(), tmppath.c_str(), FALSE))
+        return -1;
+
+    if (sync_file(tmppath) != 0 || rename_file(tmppath, dst) != 0)
+    {
+        remove_file(tmppath);
+        return -1;
+    }
+
+    return 0;
+}
+#else
+static int link_file(const path_t& src, const path_t& dst)
+{
+    // already the same file, never unlink the source
+    struct stat ss;
+    struct stat ds;
+    if (stat(src.c_str(), &ss) == 0 && stat(dst.c_str(), &ds) == 0 && ss.st_dev == ds.st_dev && ss.st_ino == ds.st_ino)
+        return 0;
+
+    unlink(dst.c_str());
+
+    if (link(src.c_str(), dst.c_str()) == 0)
+        return 0;
+
+    int in = open(src.c_str(), O_RDONLY);
+    if (in < 0)
+        return -1;
+
+    const path_t tmppath = temp_filepath(dst);
+    int out = open(tmppath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return -1;
+    }
+
+    int ret = -1;
+
+#ifdef FICLONE
+    // copy-on-write clone on btrfs xfs and friends
+    if (ioctl(out, FICLONE, in) == 0)
+        ret = 0;
+#endif
+
+    if (ret != 0)
+    {
+        std::vector<char> buffer(1024 * 1024);
+        ret = 0;
+        for (;;)
+        {
+            ssize_t n = read(in, buffer.data(), buffer.size());
+            if (n == 0)
+                break;
+
+            if (n < 0 || write(out, buffer.data(), n) != n)
+            {
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    if (ret == 0)
+        ret = fsync(out);
+
+    close(in);
+    close(out);
+
+    if (ret == 0)
+        ret = rename_file(tmppath, dst);
+
+    if (ret != 0)
+        remove_file(tmppath);
+
+    return ret;
+}
+#endif // _WIN32
+
 static path_t sanitize_filepath(const path_t& path)
 {
     if (filepath_is_readable(path))
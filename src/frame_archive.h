@@ -0,0 +1,306 @@
+#ifndef FRAME_ARCHIVE_H
+#define FRAME_ARCHIVE_H
+
+// single tar stream output, encoded frames are appended in task order
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "platform.h"
+
+#include "filesystem_utils.h"
+
+#define FRAME_ARCHIVE_BLOCK 512
+
+// ids the loaders may run ahead of the entry the archive waits for
+#define FRAME_ARCHIVE_WINDOW 64
+
+class FrameArchive
+{
+public:
+    FrameArchive()
+    {
+        fp = 0;
+        next_id = 0;
+        finished = false;
+        failed = 0;
+        thread = 0;
+        log = stderr;
+    }
+
+    ~FrameArchive()
+    {
+        close();
+    }
+
+    bool is_open() const
+    {
+        return fp != 0;
+    }
+
+    int open(const path_t& path)
+    {
+#if _WIN32
+        fp = _wfopen(path.c_str(), L"wb");
+#else
+        fp = fopen(path.c_str(), "wb");
+#endif
+        if (!fp)
+        {
+#if _WIN32
+            fwprintf(log, L"open %ls failed\n", path.c_str());
+#else
+            fprintf(log, "open %s failed\n", path.c_str());
+#endif
+            return -1;
+        }
+
+        // headers and small frames are batched into large sequential writes
+        setvbuf(fp, NULL, _IOFBF, 4 * 1024 * 1024);
+
+        next_id = 0;
+        finished = false;
+        thread = new ncnn::Thread(archive_writer, (void*)this);
+
+        return 0;
+    }
+
+    // takes over the content of data, id is the position in the archive,
+    // done is printed to log once the entry is written
+    void write(int id, const path_t& name, std::vector<unsigned char>& data, const path_t& done)
+    {
+        Entry* e = new Entry;
+        e->name = name;
+        e->done = done;
+        e->data.swap(data);
+
+        put(id, e);
+    }
+
+    // id produced no frame, do not wait for it
+    void skip(int id)
+    {
+        put(id, 0);
+    }
+
+    // called by the load stage before decoding task id, blocks while id is FRAME_ARCHIVE_WINDOW
+    // or more ahead of the next entry, so a stalled frame cannot pile up every later one in pending.
+    // every lower id has been claimed already and will be written or skipped
+    void wait_for(int id)
+    {
+        lock.lock();
+
+        while (!finished && id >= next_id + FRAME_ARCHIVE_WINDOW)
+        {
+            condition.wait(lock);
+        }
+
+        lock.unlock();
+    }
+
+    // write everything still pending in id order and the end of archive marker
+    void close()
+    {
+        if (!fp)
+            return;
+
+        lock.lock();
+        finished = true;
+        lock.unlock();
+
+        condition.broadcast();
+
+        thread->join();
+        delete thread;
+        thread = 0;
+
+        // two zero blocks end the archive
+        unsigned char zero[FRAME_ARCHIVE_BLOCK * 2];
+        memset(zero, 0, sizeof(zero));
+        fwrite(zero, 1, sizeof(zero), fp);
+
+#if _WIN32
+        bool ok = fflush(fp) == 0 && _commit(_fileno(fp)) == 0;
+#else
+        bool ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+#endif
+        ok = fclose(fp) == 0 && ok;
+        if (!ok)
+        {
+            fprintf(log, "write archive failed\n");
+            failed++;
+        }
+        fp = 0;
+    }
+
+    // entries that could not be written, final after close
+    int failures() const
+    {
+        return failed;
+    }
+
+public:
+    // progress and write errors
+    FILE* log;
+
+private:
+    struct Entry
+    {
+        path_t name;
+        path_t done;
+        std::vector<unsigned char> data;
+    };
+
+    void put(int id, Entry* e)
+    {
+        // never blocks, a save thread waiting here could hold up the frame at next_id
+        // through the bounded task queues, the frames in flight already bound the backlog
+        lock.lock();
+
+        pending[id] = e;
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    static std::string entry_name(const path_t& name)
+    {
+#if _WIN32
+        int len = WideCharToMultiByte(CP_UTF8, 0, name.c_str(), -1, NULL, 0, NULL, NULL);
+        std::string s(len, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, name.c_str(), -1, &s[0], len, NULL, NULL);
+        s.resize(len - 1);
+        return s;
+#else
+        return name;
+#endif
+    }
+
+    static void write_octal(char* field, int size, unsigned long long value)
+    {
+        // zero padded with a trailing nul
+        field[size - 1] = '\0';
+        for (int i = size - 2; i >= 0; i--)
+        {
+            field[i] = '0' + (value & 7);
+            value >>= 3;
+        }
+    }
+
+    // ustar header followed by the data padded to the block size
+    int write_entry(const Entry* e)
+    {
+        std::string name = entry_name(e->name);
+        if (name.size() > 99)
+        {
+            fprintf(log, "archive entry name %s too long\n", name.c_str());
+            return -1;
+        }
+
+        char header[FRAME_ARCHIVE_BLOCK];
+        memset(header, 0, sizeof(header));
+
+        memcpy(header, name.c_str(), name.size());
+        write_octal(header + 100, 8, 0644);
+        write_octal(header + 108, 8, 0);
+        write_octal(header + 116, 8, 0);
+        write_octal(header + 124, 12, e->data.size());
+        write_octal(header + 136, 12, 0);
+        header[156] = '0';
+        memcpy(header + 257, "ustar", 6);
+        memcpy(header + 263, "00", 2);
+
+        // checksum is computed with its own field as spaces
+        memset(header + 148, ' ', 8);
+        unsigned int checksum = 0;
+        for (int i = 0; i < FRAME_ARCHIVE_BLOCK; i++)
+        {
+            checksum += (unsigned char)header[i];
+        }
+        write_octal(header + 148, 7, checksum);
+
+        const size_t padding = (FRAME_ARCHIVE_BLOCK - e->data.size() % FRAME_ARCHIVE_BLOCK) % FRAME_ARCHIVE_BLOCK;
+        const char zero[FRAME_ARCHIVE_BLOCK] = {0};
+
+        if (fwrite(header, 1, FRAME_ARCHIVE_BLOCK, fp) != FRAME_ARCHIVE_BLOCK
+                || fwrite(e->data.data(), 1, e->data.size(), fp) != e->data.size()
+                || fwrite(zero, 1, padding, fp) != padding)
+        {
+            fprintf(log, "write archive entry %s failed\n", name.c_str());
+            return -1;
+        }
+
+        if (!e->done.empty())
+        {
+#if _WIN32
+            fputws(e->done.c_str(), log);
+#else
+            fputs(e->done.c_str(), log);
+#endif
+        }
+
+        return 0;
+    }
+
+    static void* archive_writer(void* args)
+    {
+        FrameArchive* fa = (FrameArchive*)args;
+
+        for (;;)
+        {
+            fa->lock.lock();
+
+            while (fa->pending.find(fa->next_id) == fa->pending.end() && !fa->finished)
+            {
+                fa->condition.wait(fa->lock);
+            }
+
+            if (fa->pending.empty())
+            {
+                // finished and drained
+                fa->lock.unlock();
+                break;
+            }
+
+            // in order, or the lowest id left once the producers are gone
+            std::map<int, Entry*>::iterator it = fa->pending.find(fa->next_id);
+            if (it == fa->pending.end())
+                it = fa->pending.begin();
+
+            Entry* e = it->second;
+            fa->next_id = it->first + 1;
+            fa->pending.erase(it);
+
+            fa->lock.unlock();
+
+            // loaders waiting in wait_for
+            fa->condition.broadcast();
+
+            if (e)
+            {
+                if (fa->write_entry(e) != 0)
+                    fa->failed++;
+
+                delete e;
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    FILE* fp;
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::map<int, Entry*> pending;
+    int next_id;
+    bool finished;
+    int failed;
+    ncnn::Thread* thread;
+};
+
+#endif // FRAME_ARCHIVE_H
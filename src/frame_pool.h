@@ -0,0 +1,251 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+// size-class pool of reusable frame buffers for image decoders and output images
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#if _WIN32
+#include <malloc.h>
+#else // _WIN32
+#include <sys/mman.h>
+#endif // _WIN32
+
+// ncnn
+#include "allocator.h"
+#include "platform.h"
+
+// every buffer is preceded by one cacheline of bookkeeping, which keeps the pixel data 64-byte aligned
+#define FRAME_POOL_HEADER_SIZE 64
+
+// smaller allocations are stbi internals, not frames, and bypass the free lists
+#define FRAME_POOL_MIN_POOLED_SIZE (64 * 1024)
+
+// cached buffers per size class, anything beyond is returned to the system
+#define FRAME_POOL_MAX_CACHED 32
+
+class FramePool
+{
+public:
+    FramePool()
+    {
+        use_hugepage = true;
+    }
+
+    ~FramePool()
+    {
+        clear();
+    }
+
+    void* alloc(size_t size)
+    {
+        size_t capacity = size < FRAME_POOL_MIN_POOLED_SIZE ? size : size_class(size);
+
+        if (capacity >= FRAME_POOL_MIN_POOLED_SIZE)
+        {
+            ncnn::MutexLockGuard guard(lock);
+
+            std::vector<unsigned char*>& freelist = freelists[capacity];
+            if (!freelist.empty())
+            {
+                unsigned char* ptr = freelist.back();
+                freelist.pop_back();
+                return ptr;
+            }
+        }
+
+        return allocate(capacity);
+    }
+
+    void free(void* ptr)
+    {
+        if (!ptr)
+            return;
+
+        size_t capacity = get_header((unsigned char*)ptr)->capacity;
+
+        if (capacity >= FRAME_POOL_MIN_POOLED_SIZE)
+        {
+            ncnn::MutexLockGuard guard(lock);
+
+            std::vector<unsigned char*>& freelist = freelists[capacity];
+            if (freelist.size() < FRAME_POOL_MAX_CACHED)
+            {
+                freelist.push_back((unsigned char*)ptr);
+                return;
+            }
+        }
+
+        deallocate((unsigned char*)ptr);
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        if (!ptr)
+            return alloc(size);
+
+        size_t capacity = get_header((unsigned char*)ptr)->capacity;
+        if (size <= capacity)
+            return ptr;
+
+        void* newptr = alloc(size);
+        if (!newptr)
+            return 0;
+
+        memcpy(newptr, ptr, capacity);
+        free(ptr);
+
+        return newptr;
+    }
+
+    void clear()
+    {
+        ncnn::MutexLockGuard guard(lock);
+
+        std::map<size_t, std::vector<unsigned char*> >::iterator it = freelists.begin();
+        for (; it != freelists.end(); it++)
+        {
+            for (size_t i = 0; i < it->second.size(); i++)
+            {
+                deallocate(it->second[i]);
+            }
+        }
+
+        freelists.clear();
+    }
+
+public:
+    // back large frames with transparent huge pages where available
+    bool use_hugepage;
+
+private:
+    struct Header
+    {
+        size_t capacity;
+        size_t mapped;
+    };
+
+    static Header* get_header(unsigned char* ptr)
+    {
+        return (Header*)(ptr - FRAME_POOL_HEADER_SIZE);
+    }
+
+    // round up to 4 classes per power of two, wasting at most 25% per frame
+    static size_t size_class(size_t size)
+    {
+        size_t step = FRAME_POOL_MIN_POOLED_SIZE / 4;
+        while (step * 8 <= size)
+        {
+            step *= 2;
+        }
+
+        return (size + step - 1) / step * step;
+    }
+
+    unsigned char* allocate(size_t capacity)
+    {
+        unsigned char* base = 0;
+        size_t mapped = 0;
+
+#if !_WIN32
+        const size_t hugepage_size = 2 * 1024 * 1024;
+        if (use_hugepage && capacity >= hugepage_size)
+        {
+            mapped = (capacity + FRAME_POOL_HEADER_SIZE + hugepage_size - 1) / hugepage_size * hugepage_size;
+
+            void* p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+            {
+                mapped = 0;
+            }
+            else
+            {
+#ifdef MADV_HUGEPAGE
+                madvise(p, mapped, MADV_HUGEPAGE);
+#endif
+                base = (unsigned char*)p;
+            }
+        }
+#endif // _WIN32
+
+        if (!base)
+        {
+#if _WIN32
+            base = (unsigned char*)_aligned_malloc(capacity + FRAME_POOL_HEADER_SIZE, FRAME_POOL_HEADER_SIZE);
+#else
+            void* p = 0;
+            if (posix_memalign(&p, FRAME_POOL_HEADER_SIZE, capacity + FRAME_POOL_HEADER_SIZE) != 0)
+                p = 0;
+            base = (unsigned char*)p;
+#endif
+        }
+
+        if (!base)
+            return 0;
+
+        Header* header = (Header*)base;
+        header->capacity = capacity;
+        header->mapped = mapped;
+
+        return base + FRAME_POOL_HEADER_SIZE;
+    }
+
+    static void deallocate(unsigned char* ptr)
+    {
+        Header* header = get_header(ptr);
+
+#if !_WIN32
+        if (header->mapped)
+        {
+            munmap(header, header->mapped);
+            return;
+        }
+#endif // _WIN32
+
+#if _WIN32
+        _aligned_free(header);
+#else
+        ::free(header);
+#endif
+    }
+
+private:
+    ncnn::Mutex lock;
+    std::map<size_t, std::vector<unsigned char*> > freelists;
+};
+
+static FramePool frame_pool;
+
+static inline void* frame_pool_malloc(size_t size)
+{
+    return frame_pool.alloc(size);
+}
+
+static inline void frame_pool_free(void* ptr)
+{
+    frame_pool.free(ptr);
+}
+
+static inline void* frame_pool_realloc(void* ptr, size_t size)
+{
+    return frame_pool.realloc(ptr, size);
+}
+
+// ncnn allocator handing out pooled buffers, for output images
+class FramePoolAllocator : public ncnn::Allocator
+{
+public:
+    virtual void* fastMalloc(size_t size)
+    {
+        return frame_pool_malloc(size);
+    }
+
+    virtual void fastFree(void* ptr)
+    {
+        frame_pool_free(ptr);
+    }
+};
+
+#endif // FRAME_POOL_H
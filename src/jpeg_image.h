@@ -0,0 +1,95 @@
+#ifndef JPEG_IMAGE_H
+#define JPEG_IMAGE_H
+
+// jpeg image decoder and encoder with libjpeg-turbo
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "turbojpeg.h"
+#include "frame_pool.h"
+
+unsigned char* jpeg_load(const unsigned char* buffer, int len, int* w, int* h, int* c)
+{
+    // SOI marker
+    if (len < 3 || buffer[0] != 0xFF || buffer[1] != 0xD8 || buffer[2] != 0xFF)
+        return NULL;
+
+    tjhandle handle = tjInitDecompress();
+    if (!handle)
+        return NULL;
+
+    unsigned char* pixeldata = 0;
+
+    int width = 0;
+    int height = 0;
+    int subsamp = 0;
+    int colorspace = 0;
+    if (tjDecompressHeader3(handle, buffer, len, &width, &height, &subsamp, &colorspace) == 0)
+    {
+        pixeldata = (unsigned char*)frame_pool_malloc(width * height * 3);
+
+#if _WIN32
+        const int pixel_format = TJPF_BGR;
+#else
+        const int pixel_format = TJPF_RGB;
+#endif
+
+        if (pixeldata && tjDecompress2(handle, buffer, len, pixeldata, width, width * 3, height, pixel_format, 0) != 0)
+        {
+            frame_pool_free(pixeldata);
+            pixeldata = 0;
+        }
+    }
+
+    tjDestroy(handle);
+
+    if (!pixeldata)
+        return NULL;
+
+    *w = width;
+    *h = height;
+    *c = 3;
+
+    return pixeldata;
+}
+
+// subsampling 444 422 420
+int jpeg_save(int w, int h, int c, const unsigned char* pixeldata, int quality, int subsampling, std::vector<unsigned char>& filedata)
+{
+    if (c != 3 && c != 4)
+        return 0;
+
+    tjhandle handle = tjInitCompress();
+    if (!handle)
+        return 0;
+
+    int subsamp = subsampling == 420 ? TJSAMP_420 : subsampling == 422 ? TJSAMP_422 : TJSAMP_444;
+
+#if _WIN32
+    const int pixel_format = c == 4 ? TJPF_BGRA : TJPF_BGR;
+#else
+    const int pixel_format = c == 4 ? TJPF_RGBA : TJPF_RGB;
+#endif
+
+    // compress straight into filedata, sized for the worst case
+    filedata.resize(tjBufSize(w, h, subsamp));
+
+    unsigned char* output = filedata.data();
+    unsigned long length = filedata.size();
+
+    int ret = tjCompress2(handle, pixeldata, w, w * c, h, pixel_format, &output, &length, subsamp, quality, TJFLAG_NOREALLOC);
+
+    tjDestroy(handle);
+
+    if (ret != 0)
+    {
+        filedata.clear();
+        return 0;
+    }
+
+    filedata.resize(length);
+
+    return 1;
+}
+
+#endif // JPEG_IMAGE_H
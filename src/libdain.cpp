@@ -0,0 +1,340 @@
+// libdain c api implemented with the dain class
+
+#include "libdain.h"
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <windows.h>
+#endif
+
+// ncnn
+#include "gpu.h"
+#include "platform.h"
+
+#include "dain.h"
+
+#define DAIN_JOB_PENDING 1
+#define DAIN_JOB_UNKNOWN -2
+
+// the gpu instance is process wide, shared by every context
+static ncnn::Mutex gpu_instance_lock;
+static int gpu_instance_refcount = 0;
+
+static void acquire_gpu_instance()
+{
+    ncnn::MutexLockGuard guard(gpu_instance_lock);
+
+    if (gpu_instance_refcount++ == 0)
+        ncnn::create_gpu_instance();
+}
+
+static void release_gpu_instance()
+{
+    ncnn::MutexLockGuard guard(gpu_instance_lock);
+
+    if (--gpu_instance_refcount == 0)
+        ncnn::destroy_gpu_instance();
+}
+
+class DAINJob
+{
+public:
+    int id;
+    ncnn::Mat in0image;
+    ncnn::Mat in1image;
+    ncnn::Mat outimage;
+    float timestep;
+    dain_callback callback;
+    void* userdata;
+};
+
+class DAINWorkerParams
+{
+public:
+    dain_context* ctx;
+    int device;
+};
+
+struct dain_context
+{
+    std::vector<int> gpuid;
+    int threads_per_gpu;
+    std::vector<DAIN*> dain;
+
+    std::vector<DAINWorkerParams> worker_params;
+    std::vector<ncnn::Thread*> workers;
+
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::queue<DAINJob> jobs;
+
+    // jobs without callback, DAIN_JOB_PENDING until done
+    std::map<int, int> status;
+
+    // submitted and not done yet
+    int running;
+    int next_id;
+    bool stopping;
+};
+
+static void* dain_worker(void* args)
+{
+    const DAINWorkerParams* wp = (const DAINWorkerParams*)args;
+    dain_context* ctx = wp->ctx;
+    const DAIN* dain = ctx->dain[wp->device];
+
+    for (;;)
+    {
+        ctx->lock.lock();
+
+        while (ctx->jobs.empty() && !ctx->stopping)
+        {
+            ctx->condition.wait(ctx->lock);
+        }
+
+        if (ctx->jobs.empty())
+        {
+            ctx->lock.unlock();
+            break;
+        }
+
+        DAINJob job = ctx->jobs.front();
+        ctx->jobs.pop();
+
+        ctx->lock.unlock();
+
+        int ret = 0;
+        if (job.timestep == 0.f || job.timestep == 1.f)
+        {
+            // process only rebinds outimage to the source frame, the caller reads its own out buffer
+            const ncnn::Mat& src = job.timestep == 0.f ? job.in0image : job.in1image;
+            memcpy(job.outimage.data, src.data, (size_t)src.w * src.h * 3);
+        }
+        else
+        {
+            ret = dain->process(job.in0image, job.in1image, job.timestep, job.outimage) == 0 ? 0 : -1;
+        }
+
+        if (job.callback)
+        {
+            job.callback(job.id, ret, job.userdata);
+        }
+
+        ctx->lock.lock();
+
+        if (!job.callback)
+            ctx->status[job.id] = ret;
+
+        ctx->running--;
+
+        ctx->lock.unlock();
+
+        ctx->condition.broadcast();
+    }
+
+    return 0;
+}
+
+dain_context* dain_create(const int* gpuid, int gpu_count, int threads_per_gpu, int tilesize)
+{
+    if (gpu_count < 0 || (gpu_count > 0 && !gpuid) || threads_per_gpu < 1 || tilesize < 0 || tilesize % 32 != 0)
+        return 0;
+
+    acquire_gpu_instance();
+
+    std::vector<int> devices;
+    if (gpu_count == 0)
+    {
+        devices.push_back(ncnn::get_default_gpu_index());
+    }
+    else
+    {
+        devices.assign(gpuid, gpuid + gpu_count);
+    }
+
+    for (size_t i=0; i<devices.size(); i++)
+    {
+        if (devices[i] < 0 || devices[i] >= ncnn::get_gpu_count())
+        {
+            release_gpu_instance();
+            return 0;
+        }
+    }
+
+    dain_context* ctx = new dain_context;
+    ctx->gpuid = devices;
+    ctx->threads_per_gpu = threads_per_gpu;
+    ctx->running = 0;
+    ctx->next_id = 0;
+    ctx->stopping = false;
+
+    for (size_t i=0; i<devices.size(); i++)
+    {
+        DAIN* dain = new DAIN(devices[i]);
+        dain->tilesize = tilesize == 0 ? 256 : tilesize;
+
+        ctx->dain.push_back(dain);
+    }
+
+    return ctx;
+}
+
+int dain_load(dain_context* ctx, const char* modeldir)
+{
+    if (!ctx || !modeldir || !ctx->workers.empty())
+        return -1;
+
+#if _WIN32
+    int len = MultiByteToWideChar(CP_UTF8, 0, modeldir, -1, NULL, 0);
+    std::wstring dir(len, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, modeldir, -1, &dir[0], len);
+    dir.resize(len - 1);
+#else
+    std::string dir(modeldir);
+#endif
+
+    for (size_t i=0; i<ctx->dain.size(); i++)
+    {
+        if (ctx->dain[i]->load(dir) != 0)
+            return -1;
+    }
+
+    // one worker per compute queue at most
+    ctx->worker_params.resize(ctx->dain.size());
+    for (size_t i=0; i<ctx->dain.size(); i++)
+    {
+        ctx->worker_params[i].ctx = ctx;
+        ctx->worker_params[i].device = (int)i;
+
+        int threads = std::min(ctx->threads_per_gpu, (int)ncnn::get_gpu_info(ctx->gpuid[i]).compute_queue_count());
+        for (int j=0; j<threads; j++)
+        {
+            ctx->workers.push_back(new ncnn::Thread(dain_worker, (void*)&ctx->worker_params[i]));
+        }
+    }
+
+    return 0;
+}
+
+int dain_submit(dain_context* ctx, const unsigned char* in0, const unsigned char* in1, int w, int h, float timestep, unsigned char* out, dain_callback callback, void* userdata)
+{
+    if (!ctx || ctx->workers.empty() || !in0 || !in1 || !out || w <= 0 || h <= 0 || timestep < 0.f || timestep > 1.f)
+        return -1;
+
+    DAINJob job;
+    job.in0image = ncnn::Mat(w, h, (void*)in0, (size_t)3, 3);
+    job.in1image = ncnn::Mat(w, h, (void*)in1, (size_t)3, 3);
+    job.outimage = ncnn::Mat(w, h, (void*)out, (size_t)3, 3);
+    job.timestep = timestep;
+    job.callback = callback;
+    job.userdata = userdata;
+
+    ctx->lock.lock();
+
+    job.id = ctx->next_id++;
+
+    if (!callback)
+        ctx->status[job.id] = DAIN_JOB_PENDING;
+
+    ctx->running++;
+    ctx->jobs.push(job);
+
+    ctx->lock.unlock();
+
+    ctx->condition.broadcast();
+
+    return job.id;
+}
+
+int dain_poll(dain_context* ctx, int job)
+{
+    if (!ctx)
+        return DAIN_JOB_UNKNOWN;
+
+    ncnn::MutexLockGuard guard(ctx->lock);
+
+    std::map<int, int>::iterator it = ctx->status.find(job);
+    if (it == ctx->status.end())
+        return DAIN_JOB_UNKNOWN;
+
+    const int ret = it->second;
+    if (ret != DAIN_JOB_PENDING)
+        ctx->status.erase(it);
+
+    return ret;
+}
+
+int dain_wait(dain_context* ctx, int job)
+{
+    if (!ctx)
+        return DAIN_JOB_UNKNOWN;
+
+    ctx->lock.lock();
+
+    std::map<int, int>::iterator it = ctx->status.find(job);
+    while (it != ctx->status.end() && it->second == DAIN_JOB_PENDING)
+    {
+        ctx->condition.wait(ctx->lock);
+        it = ctx->status.find(job);
+    }
+
+    int ret = DAIN_JOB_UNKNOWN;
+    if (it != ctx->status.end())
+    {
+        ret = it->second;
+        ctx->status.erase(it);
+    }
+
+    ctx->lock.unlock();
+
+    return ret;
+}
+
+void dain_wait_all(dain_context* ctx)
+{
+    if (!ctx)
+        return;
+
+    ctx->lock.lock();
+
+    while (ctx->running > 0)
+    {
+        ctx->condition.wait(ctx->lock);
+    }
+
+    ctx->lock.unlock();
+}
+
+void dain_destroy(dain_context* ctx)
+{
+    if (!ctx)
+        return;
+
+    ctx->lock.lock();
+    ctx->stopping = true;
+    ctx->lock.unlock();
+
+    ctx->condition.broadcast();
+
+    // workers drain the queue before they return
+    for (size_t i=0; i<ctx->workers.size(); i++)
+    {
+        ctx->workers[i]->join();
+        delete ctx->workers[i];
+    }
+
+    for (size_t i=0; i<ctx->dain.size(); i++)
+    {
+        delete ctx->dain[i];
+    }
+
+    delete ctx;
+
+    release_gpu_instance();
+}
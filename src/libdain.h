@@ -0,0 +1,58 @@
+// libdain c api, frame interpolation without the command line tool
+
+#ifndef LIBDAIN_H
+#define LIBDAIN_H
+
+#if defined(_WIN32) && defined(LIBDAIN_SHARED)
+#ifdef LIBDAIN_EXPORTS
+#define DAIN_API __declspec(dllexport)
+#else
+#define DAIN_API __declspec(dllimport)
+#endif
+#elif defined(LIBDAIN_SHARED) && defined(__GNUC__)
+#define DAIN_API __attribute__((visibility("default")))
+#else
+#define DAIN_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct dain_context dain_context;
+
+// called from a worker thread once the job is done, status 0 = success
+typedef void (*dain_callback)(int job, int status, void* userdata);
+
+// gpu_count devices from gpuid, NULL or 0 for the default gpu,
+// threads_per_gpu worker threads on every gpu, tilesize 0 for the default 256
+// returns NULL on invalid arguments
+DAIN_API dain_context* dain_create(const int* gpuid, int gpu_count, int threads_per_gpu, int tilesize);
+
+// loads the model on every gpu and starts the workers, modeldir is utf-8
+DAIN_API int dain_load(dain_context* ctx, const char* modeldir);
+
+// queues the frame between in0 and in1 at timestep (0~1), returns the job id or -1.
+// Frames are w*h packed 3 channel bytes, rgb on linux and macos and bgr on windows.
+// in0, in1 and out must stay valid until the job is done, out receives the result.
+// Jobs with a callback are reported only through it, the others through poll or wait
+DAIN_API int dain_submit(dain_context* ctx, const unsigned char* in0, const unsigned char* in1, int w, int h, float timestep, unsigned char* out, dain_callback callback, void* userdata);
+
+// 1 = queued or running, 0 = done, -1 = failed, -2 = unknown job
+// the status of a done job is returned once, the job is forgotten afterwards
+DAIN_API int dain_poll(dain_context* ctx, int job);
+
+// blocks until the job is done, returns its status as dain_poll
+DAIN_API int dain_wait(dain_context* ctx, int job);
+
+// blocks until every submitted job is done, callbacks included
+DAIN_API void dain_wait_all(dain_context* ctx);
+
+// waits for the submitted jobs, then stops the workers and frees the models
+DAIN_API void dain_destroy(dain_context* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBDAIN_H
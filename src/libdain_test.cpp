@@ -0,0 +1,73 @@
+// libdain test, outputs at timestep 0 and 1 are the source frames
+// exits with 77 when there is no vulkan device
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "libdain.h"
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: libdain_test model-dir\n");
+        return 1;
+    }
+
+    dain_context* ctx = dain_create(NULL, 0, 1, 0);
+    if (!ctx)
+    {
+        fprintf(stderr, "no gpu, skipped\n");
+        return 77;
+    }
+
+    if (dain_load(ctx, argv[1]) != 0)
+    {
+        fprintf(stderr, "load %s failed\n", argv[1]);
+        dain_destroy(ctx);
+        return 1;
+    }
+
+    const int w = 64;
+    const int h = 48;
+    std::vector<unsigned char> in0(w * h * 3);
+    std::vector<unsigned char> in1(w * h * 3);
+    std::vector<unsigned char> out(w * h * 3);
+
+    srand(1);
+    for (size_t i = 0; i < in0.size(); i++)
+    {
+        in0[i] = (unsigned char)(rand() & 255);
+        in1[i] = (unsigned char)(rand() & 255);
+    }
+
+    int failed = 0;
+
+    const float timesteps[2] = { 0.f, 1.f };
+    for (int i = 0; i < 2; i++)
+    {
+        const std::vector<unsigned char>& expected = i == 0 ? in0 : in1;
+
+        memset(out.data(), 0x55, out.size());
+
+        int job = dain_submit(ctx, in0.data(), in1.data(), w, h, timesteps[i], out.data(), NULL, NULL);
+        if (job < 0 || dain_wait(ctx, job) != 0)
+        {
+            fprintf(stderr, "timestep %g job failed\n", timesteps[i]);
+            failed++;
+            continue;
+        }
+
+        if (memcmp(out.data(), expected.data(), out.size()) != 0)
+        {
+            fprintf(stderr, "timestep %g output is not in%d\n", timesteps[i], i);
+            failed++;
+        }
+    }
+
+    dain_destroy(ctx);
+
+    return failed == 0 ? 0 : 1;
+}
@@ -2,10 +2,14 @@
 
 #include <stdio.h>
 #include <algorithm>
+#include <map>
 #include <queue>
 #include <vector>
 #include <clocale>
 
+// pooled frame buffers shared by decoders and output images
+#include "frame_pool.h"
+
 #if _WIN32
 // image decoder and encoder with wic
 #include "wic_image.h"
@@ -18,11 +22,27 @@
 #define STBI_NO_HDR
 #define STBI_NO_PIC
 #define STBI_NO_STDIO
+#define STBI_MALLOC(sz) frame_pool_malloc(sz)
+#define STBI_REALLOC(p,newsz) frame_pool_realloc(p,newsz)
+#define STBI_FREE(p) frame_pool_free(p)
 #include "stb_image.h"
+#if USE_LIBDEFLATE
+// png deflate with libdeflate
+#include "png_deflate.h"
+#define STBIW_ZLIB_COMPRESS png_zlib_compress
+#endif // USE_LIBDEFLATE
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #endif // _WIN32
 #include "webp_image.h"
+#if USE_TURBOJPEG
+#include "jpeg_image.h"
+#endif
+#include "qoi_image.h"
+#include "pam_image.h"
+#if USE_LIBAV
+#include "video_decoder.h"
+#endif
 
 #if _WIN32
 #include <wchar.h>
@@ -69,8 +89,31 @@ static std::vector<int> parse_optarg_int_array(const wchar_t* optarg)
 
     return array;
 }
+
+static size_t parse_optarg_size(const wchar_t* optarg)
+{
+    wchar_t* suffix = 0;
+    double size = wcstod(optarg, &suffix);
+
+    switch (*suffix)
+    {
+    case L'T': case L't': size *= 1024;
+    case L'G': case L'g': size *= 1024;
+    case L'M': case L'm': size *= 1024;
+    case L'K': case L'k': size *= 1024;
+    default: break;
+    }
+
+    return size > 0 ? (size_t)size : 0;
+}
 #else // _WIN32
 #include <unistd.h> // getopt()
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 static std::vector<int> parse_optarg_int_array(const char* optarg)
 {
@@ -87,6 +130,23 @@ static std::vector<int> parse_optarg_int_array(const char* optarg)
 
     return array;
 }
+
+static size_t parse_optarg_size(const char* optarg)
+{
+    char* suffix = 0;
+    double size = strtod(optarg, &suffix);
+
+    switch (*suffix)
+    {
+    case 'T': case 't': size *= 1024; // fallthrough
+    case 'G': case 'g': size *= 1024; // fallthrough
+    case 'M': case 'm': size *= 1024; // fallthrough
+    case 'K': case 'k': size *= 1024; // fallthrough
+    default: break;
+    }
+
+    return size > 0 ? (size_t)size : 0;
+}
 #endif // _WIN32
 
 // ncnn
@@ -98,40 +158,241 @@ static std::vector<int> parse_optarg_int_array(const char* optarg)
 #include "dain.h"
 
 #include "filesystem_utils.h"
+#include "file_writer.h"
+#include "frame_archive.h"
+#include "work_queue.h"
+#include "scene_cut.h"
+#include "border_crop.h"
+
+// level 0 stores the deflate blocks with libdeflate, stb_image_write always compresses
+#if USE_LIBDEFLATE
+#define PNG_MAX_LEVEL 12
+#define PNG_LEVEL0_NAME "stored"
+#else
+#define PNG_MAX_LEVEL 9
+#define PNG_LEVEL0_NAME "unfiltered"
+#endif
+
+class EncodeOptions
+{
+public:
+    EncodeOptions()
+    {
+        png_level = 8;
+        jpeg_quality = 100;
+        jpeg_subsampling = 444;
+        webp_lossless = 1;
+        webp_quality = 70;
+        webp_method = 4;
+        webp_thread_level = 0;
+    }
+
+    int png_level;
+    int jpeg_quality;
+    int jpeg_subsampling;
+    int webp_lossless;
+    int webp_quality;
+    int webp_method;
+    int webp_thread_level;
+};
+
+static bool is_number(const path_t& token)
+{
+    if (token.empty())
+        return false;
+
+    for (size_t i = 0; i < token.size(); i++)
+    {
+        if (token[i] < '0' || token[i] > '9')
+            return false;
+    }
+
+    return true;
+}
+
+// format options follow the format name, e.g. png:1 jpg:90:420 webp:lossless:0
+static int parse_format_options(const path_t& format, const path_t& options, EncodeOptions& eo)
+{
+    if (options.empty())
+        return 0;
+
+    std::vector<path_t> tokens;
+    std::vector<int> values;
+    {
+        size_t start = 0;
+        while (start <= options.size())
+        {
+            size_t colon = options.find(PATHSTR(':'), start);
+            if (colon == path_t::npos)
+                colon = options.size();
+
+            tokens.push_back(options.substr(start, colon - start));
+#if _WIN32
+            values.push_back(_wtoi(tokens.back().c_str()));
+#else
+            values.push_back(atoi(tokens.back().c_str()));
+#endif
+            start = colon + 1;
+        }
+    }
+
+    // every option is a number, except the lossless keyword of webp
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        if (!is_number(tokens[i]) && !(i == 0 && format == PATHSTR("webp") && tokens[i] == PATHSTR("lossless")))
+            return -1;
+    }
+
+    if (format == PATHSTR("png"))
+    {
+        if (values.size() != 1)
+            return -1;
+
+        eo.png_level = values[0];
+        if (eo.png_level < 0 || eo.png_level > PNG_MAX_LEVEL)
+            return -1;
+
+        return 0;
+    }
+
+    if (format == PATHSTR("jpg"))
+    {
+        if (values.size() > 2)
+            return -1;
+
+        eo.jpeg_quality = values[0];
+        if (eo.jpeg_quality < 1 || eo.jpeg_quality > 100)
+            return -1;
+
+        if (values.size() == 2)
+        {
+            eo.jpeg_subsampling = values[1];
+            if (eo.jpeg_subsampling != 444 && eo.jpeg_subsampling != 422 && eo.jpeg_subsampling != 420)
+                return -1;
+        }
+
+        return 0;
+    }
+
+    if (format == PATHSTR("webp"))
+    {
+        if (values.size() > 3)
+            return -1;
+
+        if (tokens[0] == PATHSTR("lossless"))
+        {
+            eo.webp_lossless = 1;
+        }
+        else
+        {
+            eo.webp_lossless = 0;
+            eo.webp_quality = values[0];
+            if (eo.webp_quality < 0 || eo.webp_quality > 100)
+                return -1;
+        }
+
+        if (values.size() >= 2)
+        {
+            eo.webp_method = values[1];
+            if (eo.webp_method < 0 || eo.webp_method > 6)
+                return -1;
+        }
+
+        if (values.size() == 3)
+        {
+            eo.webp_thread_level = values[2];
+            if (eo.webp_thread_level != 0 && eo.webp_thread_level != 1)
+                return -1;
+        }
+
+        return 0;
+    }
+
+    return -1;
+}
 
 static void print_usage()
 {
     fprintf(stderr, "Usage: dain-ncnn-vulkan -0 infile -1 infile1 -o outfile [options]...\n");
-    fprintf(stderr, "       dain-ncnn-vulkan -i indir -o outdir [options]...\n\n");
+    fprintf(stderr, "       dain-ncnn-vulkan -i indir -o outdir [options]...\n");
+#if !_WIN32
+    fprintf(stderr, "       dain-ncnn-vulkan -d socket [options]...\n");
+#endif
+    fprintf(stderr, "\n");
     fprintf(stderr, "  -h                   show this help\n");
     fprintf(stderr, "  -v                   verbose output\n");
-    fprintf(stderr, "  -0 input0-path       input image0 path (jpg/png/webp)\n");
-    fprintf(stderr, "  -1 input1-path       input image1 path (jpg/png/webp)\n");
-    fprintf(stderr, "  -i input-path        input image directory (jpg/png/webp)\n");
-    fprintf(stderr, "  -o output-path       output image path (jpg/png/webp) or directory\n");
+    fprintf(stderr, "  -0 input0-path       input image0 path (jpg/png/webp/qoi/pam/ppm)\n");
+    fprintf(stderr, "  -1 input1-path       input image1 path (jpg/png/webp/qoi/pam/ppm)\n");
+#if USE_LIBAV
+    fprintf(stderr, "  -i input-path        input image directory (jpg/png/webp/qoi/pam/ppm) or video file\n");
+#else
+    fprintf(stderr, "  -i input-path        input image directory (jpg/png/webp/qoi/pam/ppm)\n");
+#endif
+    fprintf(stderr, "  -o output-path       output image path (jpg/png/webp/qoi/pam/ppm) or directory or tar file\n");
     fprintf(stderr, "  -n num-frame         target frame count (default=N*2)\n");
     fprintf(stderr, "  -s time-step         time step (0~1, default=0.5)\n");
+    fprintf(stderr, "  -x scene-threshold   repeat the nearest frame across scene cuts (0~1, default=0=off)\n");
+    fprintf(stderr, "  -u dup-tolerance     retime across runs of held frames differing by at most dup-tolerance (0~255, default=off)\n");
+    fprintf(stderr, "  -b border-level      leave letterbox bars up to border-level out of the networks (-1=off,0~255, default=-1)\n");
     fprintf(stderr, "  -t tile-size         tile size (>=128, default=256) can be 256,256,128 for multi-gpu\n");
+    fprintf(stderr, "  -k static-tolerance  skip tiles differing by at most static-tolerance between the frames (-1=off,0~255, default=-1)\n");
     fprintf(stderr, "  -m model-path        dain model path (default=best)\n");
     fprintf(stderr, "  -g gpu-id            gpu device to use (default=auto) can be 0,1,2 for multi-gpu\n");
     fprintf(stderr, "  -j load:proc:save    thread count for load/proc/save (default=1:2:2) can be 1:2,2,2:2 for multi-gpu\n");
-    fprintf(stderr, "  -f pattern-format    output image filename pattern format (%%08d.jpg/png/webp, default=ext/%%08d.png)\n");
+    fprintf(stderr, "  -f pattern-format    output image filename pattern format (%%08d.jpg/png/webp/qoi/pam/ppm, default=ext/%%08d.png)\n");
+    fprintf(stderr, "                       png:level sets png compression level (0=%s,1~%d, default=8)\n", PNG_LEVEL0_NAME, PNG_MAX_LEVEL);
+    fprintf(stderr, "                       jpg:quality:subsampling sets jpeg quality (1~100, default=100) and chroma subsampling (444/422/420)\n");
+    fprintf(stderr, "                       webp:quality:method:mt sets lossy quality (0~100) or lossless, method (0~6, default=4) and multi-threading (0/1)\n");
+    fprintf(stderr, "  -M max-host-mem      host memory budget for frames in flight (e.g. 4G, default=unlimited)\n");
+    fprintf(stderr, "  -r                   resume, skip outputs that already exist\n");
+    fprintf(stderr, "  -S shard/count       run only the shard-th (0~count-1) of count output ranges\n");
+    fprintf(stderr, "  -w job-dir           share the job with other workers through a directory on a shared filesystem\n");
+#if !_WIN32
+    fprintf(stderr, "  -d socket-path       serve jobs on a unix socket, models stay loaded between jobs\n");
+    fprintf(stderr, "  -c socket-path       run the job on the server listening on socket-path\n");
+#endif
 }
 
-static int decode_image(const path_t& imagepath, ncnn::Mat& image, int* webp)
+// errors go to log
+static int decode_image(const path_t& imagepath, ncnn::Mat& image, int* pooled, FILE* log)
 {
-    *webp = 0;
+    *pooled = 0;
 
     unsigned char* pixeldata = 0;
     int w;
     int h;
     int c;
 
+    path_t ext = get_file_extension(imagepath);
+    if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
+    {
 #if _WIN32
-    FILE* fp = _wfopen(imagepath.c_str(), L"rb");
+        FILE* fp = _wfopen(imagepath.c_str(), L"rb");
 #else
-    FILE* fp = fopen(imagepath.c_str(), "rb");
+        FILE* fp = fopen(imagepath.c_str(), "rb");
 #endif
+        if (fp)
+        {
+            fseek(fp, 0, SEEK_END);
+            long length = ftell(fp);
+            rewind(fp);
+
+            // large files are decoded while the rest is still read
+            if (length >= WEBP_STREAM_MIN_SIZE)
+            {
+                pixeldata = webp_load_stream(fp, (size_t)length, &w, &h, &c);
+                if (pixeldata)
+                {
+                    *pooled = 1;
+                }
+            }
+
+            fclose(fp);
+        }
+    }
+
+#if _WIN32
+    FILE* fp = pixeldata ? NULL : _wfopen(imagepath.c_str(), L"rb");
     if (fp)
     {
         // read whole file
@@ -152,31 +413,74 @@ static int decode_image(const path_t& imagepath, ncnn::Mat& image, int* webp)
         if (filedata)
         {
             pixeldata = webp_load(filedata, length, &w, &h, &c);
+#if USE_TURBOJPEG
+            if (!pixeldata)
+            {
+                pixeldata = jpeg_load(filedata, length, &w, &h, &c);
+            }
+#endif
+            if (!pixeldata)
+            {
+                pixeldata = qoi_load(filedata, length, &w, &h, &c);
+            }
+            if (!pixeldata)
+            {
+                pixeldata = pam_load(filedata, length, &w, &h, &c);
+            }
             if (pixeldata)
             {
-                *webp = 1;
+                *pooled = 1;
             }
             else
             {
                 // not webp, try jpg png etc.
-#if _WIN32
                 pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
-#else // _WIN32
-                pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
-                c = 3;
-#endif // _WIN32
             }
 
             free(filedata);
         }
     }
+#else // _WIN32
+    size_t length = 0;
+    unsigned char* filedata = pixeldata ? NULL : map_file(imagepath, &length);
+    if (filedata)
+    {
+        pixeldata = webp_load(filedata, length, &w, &h, &c);
+#if USE_TURBOJPEG
+        if (!pixeldata)
+        {
+            pixeldata = jpeg_load(filedata, length, &w, &h, &c);
+        }
+#endif
+        if (!pixeldata)
+        {
+            pixeldata = qoi_load(filedata, length, &w, &h, &c);
+        }
+        if (!pixeldata)
+        {
+            pixeldata = pam_load(filedata, length, &w, &h, &c);
+        }
+        if (pixeldata)
+        {
+            *pooled = 1;
+        }
+        else
+        {
+            // not webp, try jpg png etc.
+            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
+            c = 3;
+        }
+
+        unmap_file(filedata, length);
+    }
+#endif // _WIN32
 
     if (!pixeldata)
     {
 #if _WIN32
-        fwprintf(stderr, L"decode image %ls failed\n", imagepath.c_str());
+        fwprintf(log, L"decode image %ls failed\n", imagepath.c_str());
 #else // _WIN32
-        fprintf(stderr, "decode image %s failed\n", imagepath.c_str());
+        fprintf(log, "decode image %s failed\n", imagepath.c_str());
 #endif // _WIN32
 
         return -1;
@@ -187,252 +491,2741 @@ static int decode_image(const path_t& imagepath, ncnn::Mat& image, int* webp)
     return 0;
 }
 
-static int encode_image(const path_t& imagepath, const ncnn::Mat& image)
+#if !_WIN32
+static void stbi_write_to_vector(void* context, void* data, int size)
+{
+    std::vector<unsigned char>* filedata = (std::vector<unsigned char>*)context;
+    filedata->insert(filedata->end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+#endif // _WIN32
+
+// id orders the frame in frame_archive when the output is a single tar file, errors go to log.
+// returns 0 once written, 1 when handed to file_writer or frame_archive, which print done when they have written it
+static int encode_image(const path_t& imagepath, const ncnn::Mat& image, const EncodeOptions& eo, FileWriter& file_writer, FrameArchive& frame_archive, int id, const path_t& done, FILE* log)
 {
     int success = 0;
 
     path_t ext = get_file_extension(imagepath);
 
+    // encoded in memory and handed to file_writer, so the save threads never wait on disk
+    std::vector<unsigned char> filedata;
+
+    // encoders writing their own file go through a temporary name as well
+    const path_t tmppath = temp_filepath(imagepath);
+
     if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
     {
-        success = webp_save(imagepath.c_str(), image.w, image.h, image.elempack, (const unsigned char*)image.data);
+        success = webp_save(image.w, image.h, image.elempack, (const unsigned char*)image.data, eo.webp_lossless, eo.webp_quality, eo.webp_method, eo.webp_thread_level, filedata);
     }
     else if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
     {
 #if _WIN32
-        success = wic_encode_image(imagepath.c_str(), image.w, image.h, image.elempack, image.data);
+        success = wic_encode_image(tmppath.c_str(), image.w, image.h, image.elempack, image.data);
 #else
-        success = stbi_write_png(imagepath.c_str(), image.w, image.h, image.elempack, image.data, 0);
+#if USE_LIBDEFLATE
+        png_deflate_level = eo.png_level;
+#endif
+        success = stbi_write_png_to_func(stbi_write_to_vector, &filedata, image.w, image.h, image.elempack, image.data, 0);
 #endif
     }
     else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
     {
-#if _WIN32
-        success = wic_encode_jpeg_image(imagepath.c_str(), image.w, image.h, image.elempack, image.data);
+#if USE_TURBOJPEG
+        success = jpeg_save(image.w, image.h, image.elempack, (const unsigned char*)image.data, eo.jpeg_quality, eo.jpeg_subsampling, filedata);
+#elif _WIN32
+        success = wic_encode_jpeg_image(tmppath.c_str(), image.w, image.h, image.elempack, image.data);
 #else
-        success = stbi_write_jpg(imagepath.c_str(), image.w, image.h, image.elempack, image.data, 100);
+        success = stbi_write_jpg_to_func(stbi_write_to_vector, &filedata, image.w, image.h, image.elempack, image.data, eo.jpeg_quality);
 #endif
     }
+    else if (ext == PATHSTR("qoi") || ext == PATHSTR("QOI"))
+    {
+        success = qoi_save(image.w, image.h, image.elempack, (const unsigned char*)image.data, filedata);
+    }
+    else if (ext == PATHSTR("pam") || ext == PATHSTR("PAM") || ext == PATHSTR("ppm") || ext == PATHSTR("PPM"))
+    {
+        const int ppm = ext == PATHSTR("ppm") || ext == PATHSTR("PPM");
+        if (frame_archive.is_open())
+        {
+            success = pam_encode(image.w, image.h, image.elempack, (const unsigned char*)image.data, ppm, filedata);
+        }
+        else
+        {
+            // written directly, without encoding there is nothing to gain from file_writer
+            success = pam_save(tmppath.c_str(), image.w, image.h, image.elempack, (const unsigned char*)image.data, ppm);
+        }
+    }
+
+    bool queued = false;
+
+    if (frame_archive.is_open())
+    {
+        if (success && !filedata.empty())
+        {
+            frame_archive.write(id, imagepath, filedata, done);
+            queued = true;
+        }
+        else
+        {
+            frame_archive.skip(id);
+        }
+    }
+    else if (success && !filedata.empty())
+    {
+        file_writer.write(imagepath, filedata, done);
+        queued = true;
+    }
+    else if (success && (sync_file(tmppath) != 0 || rename_file(tmppath, imagepath) != 0))
+    {
+        remove_file(tmppath);
+        success = 0;
+    }
+    else if (!success)
+    {
+        remove_file(tmppath);
+    }
 
     if (!success)
     {
 #if _WIN32
-        fwprintf(stderr, L"encode image %ls failed\n", imagepath.c_str());
+        fwprintf(log, L"encode image %ls failed\n", imagepath.c_str());
 #else
-        fprintf(stderr, "encode image %s failed\n", imagepath.c_str());
+        fprintf(log, "encode image %s failed\n", imagepath.c_str());
 #endif
     }
 
-    return success ? 0 : -1;
+    if (!success)
+        return -1;
+
+    return queued ? 1 : 0;
+}
+
+// lowercase extension with jpeg folded into jpg
+static path_t image_format(const path_t& path)
+{
+    path_t ext = get_file_extension(path);
+    for (size_t i = 0; i < ext.size(); i++)
+    {
+        if (ext[i] >= 'A' && ext[i] <= 'Z')
+            ext[i] = ext[i] - 'A' + 'a';
+    }
+
+    if (ext == PATHSTR("jpeg"))
+        ext = PATHSTR("jpg");
+
+    return ext;
+}
+
+// timestep 0 or 1 output in the same format as its source, the source file is reused without decoding
+static int passthrough_file(const path_t& srcpath, const path_t& outpath, FrameArchive& frame_archive, int id)
+{
+    if (image_format(srcpath) != image_format(outpath))
+        return -1;
+
+    if (frame_archive.is_open())
+    {
+        std::vector<unsigned char> filedata;
+        if (read_file(srcpath, filedata) != 0)
+            return -1;
+
+        frame_archive.write(id, outpath, filedata, path_t());
+        return 0;
+    }
+
+    return link_file(srcpath, outpath);
 }
 
+class Session;
+
 class Task
 {
 public:
+    Session* session;
     int id;
-    int webp0;
-    int webp1;
+
+    // 0 = stbi or wic malloc, 1 = frame_pool, 2 = owned by the Mat refcount
+    int pooled0;
+    int pooled1;
 
     path_t in0path;
     path_t in1path;
     path_t outpath;
     float timestep;
 
-    ncnn::Mat in0image;
-    ncnn::Mat in1image;
-    ncnn::Mat outimage;
-};
+    // decoded bytes accounted in host_memory_budget
+    size_t hostmem;
+
+    // source frame indices and output timestamp in seconds, video input only
+    int frame0;
+    int frame1;
+    double pts;
+
+    // picture area run through the networks, the bars around it are blended
+    int area_x;
+    int area_y;
+    int area_w;
+    int area_h;
+
+    ncnn::Mat in0image;
+    ncnn::Mat in1image;
+    ncnn::Mat outimage;
+};
+
+class TaskQueue
+{
+public:
+    TaskQueue()
+    {
+        max_length = 8;
+    }
+
+    void put(const Task& v)
+    {
+        lock.lock();
+
+        while (max_length > 0 && (int)tasks.size() >= max_length)
+        {
+            condition.wait(lock);
+        }
+
+        tasks.push(v);
+
+        lock.unlock();
+
+        condition.signal();
+    }
+
+    void get(Task& v)
+    {
+        lock.lock();
+
+        while (tasks.size() == 0)
+        {
+            condition.wait(lock);
+        }
+
+        v = tasks.front();
+        tasks.pop();
+
+        lock.unlock();
+
+        condition.signal();
+    }
+
+public:
+    // 0 = unbounded, when host_memory_budget limits the frames in flight
+    int max_length;
+
+private:
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::queue<Task> tasks;
+};
+
+// proc queue shared by all gpus, measuring the frame time of each device online.
+// Every session queues into its own lane and the lanes are served round-robin,
+// so concurrent sessions share the gpus fairly. Once a session has loaded its
+// last task, a device leaves the lane alone when faster devices would clear it
+// before it finishes one frame, so the tail of a job is taken over by the fast
+// devices instead of waiting on a slow one
+class ProcScheduler
+{
+public:
+    ProcScheduler()
+    {
+        max_length = 8;
+        shutdown = false;
+        last_lane = -1;
+        start_time = 0;
+    }
+
+    void init(const std::vector<int>& gpuid, const std::vector<int>& jobs_proc)
+    {
+        devices.resize(gpuid.size());
+        for (size_t i=0; i<gpuid.size(); i++)
+        {
+            devices[i].gpuid = gpuid[i];
+            devices[i].threads = jobs_proc[i];
+            devices[i].frame_time = 0;
+            devices[i].timed_frames = 0;
+            devices[i].frames = 0;
+            devices[i].busy_time = 0;
+        }
+
+        start_time = ncnn::get_current_time();
+    }
+
+    void open_lane(int lane)
+    {
+        lock.lock();
+
+        Lane& l = lanes[lane];
+        l.running = 0;
+        l.closed = false;
+
+        lock.unlock();
+    }
+
+    // no more tasks will be put into lane
+    void close_lane(int lane)
+    {
+        lock.lock();
+        lanes[lane].closed = true;
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    // blocks until every task of a closed lane has been processed
+    void wait_lane(int lane)
+    {
+        lock.lock();
+
+        for (;;)
+        {
+            std::map<int, Lane>::iterator it = lanes.find(lane);
+            if (it->second.tasks.empty() && it->second.running == 0)
+            {
+                lanes.erase(it);
+                break;
+            }
+
+            condition.wait(lock);
+        }
+
+        lock.unlock();
+    }
+
+    // proc threads return once the lanes are gone
+    void finish()
+    {
+        lock.lock();
+        shutdown = true;
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    void put(int lane, const Task& v)
+    {
+        lock.lock();
+
+        while (max_length > 0 && (int)lanes[lane].tasks.size() >= max_length)
+        {
+            condition.wait(lock);
+        }
+
+        lanes[lane].tasks.push(v);
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    // returns false once nothing is left for this device
+    bool get(int device, Task& v)
+    {
+        lock.lock();
+
+        std::map<int, Lane>::iterator it;
+        for (;;)
+        {
+            it = next_lane(device);
+            if (it != lanes.end())
+                break;
+
+            if (shutdown && lanes.empty())
+            {
+                lock.unlock();
+                return false;
+            }
+
+            condition.wait(lock);
+        }
+
+        v = it->second.tasks.front();
+        it->second.tasks.pop();
+        it->second.running++;
+        last_lane = it->first;
+
+        lock.unlock();
+
+        condition.broadcast();
+
+        return true;
+    }
+
+    // a task from get is done, frame_time in milliseconds for one proc thread of device
+    void report(int device, int lane, double frame_time)
+    {
+        lock.lock();
+
+        Device& d = devices[device];
+        d.frame_time = d.timed_frames == 0 ? frame_time : d.frame_time * 0.8 + frame_time * 0.2;
+        d.timed_frames++;
+        d.frames++;
+        d.busy_time += frame_time;
+
+        lanes[lane].running--;
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    // a split frame from get is done, band_times in milliseconds of every device.
+    // the wall time of a frame shared by all devices says nothing about the speed of one,
+    // so only the busy times are counted
+    void report_split(int device, int lane, const std::vector<double>& band_times)
+    {
+        lock.lock();
+
+        devices[device].frames++;
+        for (size_t i=0; i<devices.size() && i<band_times.size(); i++)
+        {
+            devices[i].busy_time += band_times[i];
+        }
+
+        lanes[lane].running--;
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    void print_utilization() const
+    {
+        const double elapsed = ncnn::get_current_time() - start_time;
+
+        for (size_t i=0; i<devices.size(); i++)
+        {
+            const Device& d = devices[i];
+            fprintf(stderr, "gpu %d: %d frames, %.2f fps, %.1f ms/frame, %.0f%% busy\n", d.gpuid, d.frames, d.frames * 1000.0 / elapsed, d.frame_time, d.busy_time * 100.0 / (elapsed * d.threads));
+        }
+    }
+
+private:
+    struct Lane
+    {
+        std::queue<Task> tasks;
+        int running;
+        bool closed;
+    };
+
+    // the lane after the one served last that this device should take from
+    std::map<int, Lane>::iterator next_lane(int device)
+    {
+        std::map<int, Lane>::iterator it = lanes.upper_bound(last_lane);
+        for (size_t n=0; n<lanes.size(); n++, it++)
+        {
+            if (it == lanes.end())
+                it = lanes.begin();
+
+            if (!it->second.tasks.empty() && !leave_to_faster(device, it->second))
+                return it;
+        }
+
+        return lanes.end();
+    }
+
+    bool leave_to_faster(int device, const Lane& lane) const
+    {
+        const Device& d = devices[device];
+        if (!lane.closed || d.timed_frames == 0)
+            return false;
+
+        // frames per millisecond of the strictly faster devices, the fastest never yields
+        double faster_rate = 0;
+        for (size_t i=0; i<devices.size(); i++)
+        {
+            const Device& e = devices[i];
+            if (e.timed_frames > 0 && e.frame_time < d.frame_time)
+                faster_rate += e.threads / e.frame_time;
+        }
+
+        return (double)lane.tasks.size() <= faster_rate * d.frame_time;
+    }
+
+public:
+    // 0 = unbounded, when host_memory_budget limits the frames in flight
+    int max_length;
+
+private:
+    struct Device
+    {
+        int gpuid;
+        int threads;
+        double frame_time;
+        // frames processed by this device alone, frame_time averages these
+        int timed_frames;
+        int frames;
+        double busy_time;
+    };
+
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::map<int, Lane> lanes;
+    int last_lane;
+    bool shutdown;
+    std::vector<Device> devices;
+    double start_time;
+};
+
+ProcScheduler toproc;
+
+class HostMemoryBudget
+{
+public:
+    HostMemoryBudget()
+    {
+        budget = 0;
+        inflight = 0;
+    }
+
+    void acquire(size_t size)
+    {
+        lock.lock();
+
+        // always admit one task so that a single frame larger than the budget still makes progress
+        while (budget > 0 && inflight > 0 && inflight + size > budget)
+        {
+            condition.wait(lock);
+        }
+
+        inflight += size;
+
+        lock.unlock();
+    }
+
+    void release(size_t size)
+    {
+        lock.lock();
+
+        inflight -= size;
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+    // corrects an amount acquired before decoding to the decoded size, never blocks
+    void adjust(size_t acquired, size_t size)
+    {
+        lock.lock();
+
+        inflight = inflight - acquired + size;
+
+        lock.unlock();
+
+        if (size < acquired)
+            condition.broadcast();
+    }
+
+public:
+    // 0 = unlimited
+    size_t budget;
+
+private:
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    size_t inflight;
+};
+
+HostMemoryBudget host_memory_budget;
+
+FramePoolAllocator frame_pool_allocator;
+
+// computes the inputs, output and timestep of each output frame on demand,
+// only the sorted input filenames are kept for the whole job
+class TaskPlanner
+{
+public:
+    TaskPlanner()
+    {
+        count = 0;
+        video_input = false;
+        archive_output = false;
+        numframe = 1;
+        shard_begin = 0;
+        shard_end = 1;
+        timestep = 0.5f;
+        base = 0;
+    }
+
+    // planner of the outputs begin to end - 1 of the job planned by whole, which must outlive it.
+    // the filenames and keyframes are read from whole instead of being copied for every chunk
+    void plan_chunk(const TaskPlanner& whole, int begin, int end)
+    {
+        base = &whole;
+        inputpath = whole.inputpath;
+        count = whole.count;
+        video_input = whole.video_input;
+        outputpath = whole.outputpath;
+        pattern = whole.pattern;
+        format = whole.format;
+        archive_output = whole.archive_output;
+        numframe = whole.numframe;
+        shard_begin = begin;
+        shard_end = end;
+    }
+
+    const std::vector<path_t>& source_filenames() const
+    {
+        return base ? base->filenames : filenames;
+    }
+
+    const std::vector<int>& source_keyframes() const
+    {
+        return base ? base->keyframes : keyframes;
+    }
+
+    int size() const
+    {
+        return shard_end - shard_begin;
+    }
+
+    // task counts from the first output of the shard, sx is the index of the first source frame
+    void plan(int task, path_t& in0path, path_t& in1path, path_t& outpath, float& ts, int& sx) const
+    {
+        if (inputpath.empty())
+        {
+            in0path = input0path;
+            in1path = input1path;
+            outpath = outputpath;
+            ts = timestep;
+            sx = 0;
+            return;
+        }
+
+        // output frame index in the whole job, so shards name their outputs as a single run would
+        const int i = shard_begin + task;
+
+        const double scale = (double)count / numframe;
+
+        // TODO provide option to control timestep interpolate method
+//         float fx = (float)((i + 0.5) * scale - 0.5);
+        float fx = i * scale;
+        int sx1;
+        if (!source_keyframes().empty())
+        {
+            retime(i * scale, sx, sx1, fx);
+        }
+        else
+        {
+            sx = static_cast<int>(floor(fx));
+            fx -= sx;
+
+            if (sx < 0)
+            {
+                sx = 0;
+                fx = 0.f;
+            }
+            if (sx >= count - 1)
+            {
+                sx = count - 2;
+                fx = 1.f;
+            }
+
+            sx1 = sx + 1;
+        }
+
+//         fprintf(stderr, "%d %f %d\n", i, fx, sx);
+
+#if _WIN32
+        wchar_t tmp[256];
+        swprintf(tmp, pattern.c_str(), i+1);
+#else
+        char tmp[256];
+        sprintf(tmp, pattern.c_str(), i+1); // ffmpeg start from 1
+#endif
+        path_t output_filename = path_t(tmp) + PATHSTR('.') + format;
+
+        if (video_input)
+        {
+            in0path = inputpath;
+            in1path = inputpath;
+        }
+        else
+        {
+            in0path = inputpath + PATHSTR('/') + source_filenames()[sx];
+            in1path = inputpath + PATHSTR('/') + source_filenames()[sx1];
+        }
+        outpath = archive_output ? output_filename : outputpath + PATHSTR('/') + output_filename;
+        ts = fx;
+    }
+
+private:
+    // position t of the source timeline between the distinct frames around it,
+    // so the motion of a held run is spread over all of its outputs
+    void retime(double t, int& sx, int& sx1, float& fx) const
+    {
+        const std::vector<int>& keyframes = source_keyframes();
+        const int n = (int)keyframes.size();
+
+        // keyframes is the window of runs around the shard, it starts with the run
+        // holding the first source frame of the shard, so keyframes[0] <= floor(t)
+        int j = (int)(std::upper_bound(keyframes.begin(), keyframes.end(), (int)floor(t)) - keyframes.begin()) - 1;
+
+        if (j < 0)
+        {
+            // t before the window, hold its first frame rather than index before it
+            j = 0;
+            t = keyframes[0];
+        }
+
+        if (n == 1)
+        {
+            // nothing but one held frame
+            sx = keyframes[0];
+            sx1 = keyframes[0];
+            fx = 0.f;
+            return;
+        }
+
+        if (j >= n - 1)
+        {
+            // the last run is held to the end
+            j = n - 2;
+            sx = keyframes[j];
+            sx1 = keyframes[j + 1];
+            fx = 1.f;
+            return;
+        }
+
+        sx = keyframes[j];
+        sx1 = keyframes[j + 1];
+        fx = (float)((t - sx) / (sx1 - sx));
+    }
+
+public:
+    // directory or video input, count source frames
+    path_t inputpath;
+    std::vector<path_t> filenames;
+    int count;
+    bool video_input;
+
+    // indices of the filenames starting a run of identical frames, empty = every frame is distinct
+    std::vector<int> keyframes;
+
+    path_t outputpath;
+    path_t pattern;
+    path_t format;
+    bool archive_output;
+    int numframe;
+
+    // outputs shard_begin to shard_end - 1 of numframe are planned
+    int shard_begin;
+    int shard_end;
+
+    // single pair when inputpath is empty
+    path_t input0path;
+    path_t input1path;
+    float timestep;
+
+    // planner of the whole job for a chunk planner, 0 otherwise
+    const TaskPlanner* base;
+};
+
+// command line or socket request describing one job
+class JobOptions
+{
+public:
+    JobOptions()
+    {
+        numframe = 0;
+        timestep = 0.5f;
+        jobs_load = 1;
+        jobs_save = 2;
+        verbose = 0;
+        pattern_format = PATHSTR("%08d.png");
+        resume = 0;
+        shard_index = 0;
+        shard_count = 1;
+        scene_threshold = 0.f;
+        dup_tolerance = -1;
+        border_level = -1;
+        static_tolerance = -1;
+    }
+
+    path_t input0path;
+    path_t input1path;
+    path_t inputpath;
+    path_t outputpath;
+    int numframe;
+    float timestep;
+    int jobs_load;
+    int jobs_save;
+    int verbose;
+    path_t pattern_format;
+    int resume;
+
+    // this run plans the shard_index-th of shard_count contiguous output ranges
+    int shard_index;
+    int shard_count;
+
+    // 0 = no scene cut detection
+    float scene_threshold;
+
+    // largest pixel difference between held frames, -1 = every frame is distinct
+    int dup_tolerance;
+
+    // largest channel value of letterbox and pillarbox bars, -1 = no cropping
+    int border_level;
+
+    // largest pixel difference of tiles skipping the networks, -1 = every tile is processed
+    int static_tolerance;
+};
+
+// one job with its own load and save stages, the dain instances and proc threads are shared
+class Session
+{
+public:
+    Session()
+    {
+        id = 0;
+        jobs_load = 1;
+        jobs_save = 2;
+        verbose = 0;
+        resume = 0;
+        prefetch_window = 4;
+        archive_output = false;
+        video_input = false;
+        split_frame = false;
+        scene_threshold = 0.f;
+        static_tolerance = -1;
+        log = stderr;
+        failures = 0;
+        work_queue = 0;
+        chunk = -1;
+        loaded = false;
+    }
+
+    // every task has left the load stage
+    void set_loaded()
+    {
+        load_lock.lock();
+        loaded = true;
+        load_lock.unlock();
+
+        load_condition.broadcast();
+    }
+
+    void wait_loaded()
+    {
+        load_lock.lock();
+
+        while (!loaded)
+        {
+            load_condition.wait(load_lock);
+        }
+
+        load_lock.unlock();
+    }
+
+    // the claim of the chunk was taken over by another worker
+    bool cancelled() const
+    {
+        return work_queue && work_queue->lost(chunk);
+    }
+
+    // an output could not be decoded, encoded or written
+    void count_failure()
+    {
+        failure_lock.lock();
+        failures++;
+        failure_lock.unlock();
+    }
+
+    // lane in toproc
+    int id;
+
+    int jobs_load;
+    int jobs_save;
+    int verbose;
+    int resume;
+
+    // decoded tasks allowed ahead of the oldest one not yet queued for proc
+    int prefetch_window;
+
+    TaskPlanner planner;
+    EncodeOptions encode_options;
+    bool archive_output;
+    bool video_input;
+
+    // a single pair, every frame is split across the gpus
+    bool split_frame;
+
+    // pairs whose luma histograms differ more are a hard cut, 0 = never
+    float scene_threshold;
+
+    BorderCrop border_crop;
+
+    // tiles differing by at most this between the frames skip the networks, -1 = never
+    int static_tolerance;
+
+    // progress and job errors
+    FILE* log;
+
+    TaskQueue tosave;
+    FileWriter file_writer;
+    FrameArchive frame_archive;
+
+#if USE_LIBAV
+    VideoDecoder video;
+#endif
+
+    ncnn::Mutex failure_lock;
+    int failures;
+
+    // chunk of a work queue, -1 otherwise
+    WorkQueue* work_queue;
+    int chunk;
+
+    ncnn::Mutex load_lock;
+    ncnn::ConditionVariable load_condition;
+    bool loaded;
+};
+
+// decode workers claim tasks dynamically, at most window tasks ahead of the
+// oldest one not handed on yet, finished tasks are handed on in id order
+class LoadDispatcher
+{
+public:
+    LoadDispatcher(int _count, int _window)
+    {
+        count = _count;
+        window = _window;
+        next_id = 0;
+        emit_id = 0;
+        reserve_id = 0;
+        estimate = 0;
+        emitting = false;
+    }
+
+    // returns -1 when every task has been claimed
+    int claim()
+    {
+        lock.lock();
+
+        while (next_id < count && next_id >= emit_id + window)
+        {
+            condition.wait(lock);
+        }
+
+        const int id = next_id < count ? next_id++ : -1;
+
+        lock.unlock();
+
+        return id;
+    }
+
+    // host memory for claimed task id before it is decoded, the largest task seen so far.
+    // acquired in id order, a worker blocking here on a later task would starve the one
+    // every decoded task waits for
+    size_t reserve(int id)
+    {
+        lock.lock();
+
+        while (reserve_id != id)
+        {
+            condition.wait(lock);
+        }
+
+        const size_t size = estimate;
+
+        lock.unlock();
+
+        host_memory_budget.acquire(size);
+
+        lock.lock();
+        reserve_id++;
+        lock.unlock();
+
+        condition.broadcast();
+
+        return size;
+    }
+
+    // target 0 = nothing to hand on, 1 = toproc, 2 = tosave, reserved is what reserve returned
+    void complete(const Task& v, int target, size_t reserved)
+    {
+        host_memory_budget.adjust(reserved, target != 0 ? v.hostmem : 0);
+
+        lock.lock();
+
+        if (target != 0)
+            estimate = std::max(estimate, v.hostmem);
+
+        ready[v.id] = std::make_pair(v, target);
+
+        // another worker is already handing tasks on and will pick this one up
+        if (emitting)
+        {
+            lock.unlock();
+            return;
+        }
+
+        emitting = true;
+
+        for (;;)
+        {
+            std::map<int, std::pair<Task, int> >::iterator it = ready.find(emit_id);
+            if (it == ready.end())
+                break;
+
+            Task t = it->second.first;
+            const int t_target = it->second.second;
+            ready.erase(it);
+            emit_id++;
+
+            lock.unlock();
+
+            condition.broadcast();
+
+            if (t_target != 0)
+            {
+                if (t_target == 1)
+                    toproc.put(t.session->id, t);
+                else
+                    t.session->tosave.put(t);
+            }
+
+            lock.lock();
+        }
+
+        emitting = false;
+
+        lock.unlock();
+    }
+
+private:
+    int count;
+    int window;
+    int next_id;
+    int emit_id;
+    int reserve_id;
+    size_t estimate;
+    bool emitting;
+    std::map<int, std::pair<Task, int> > ready;
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+};
+
+class LoadWorkerParams
+{
+public:
+    Session* session;
+    LoadDispatcher* dispatcher;
+};
+
+static void release_decoded_image(ncnn::Mat& image, int pooled)
+{
+    unsigned char* pixeldata = (unsigned char*)image.data;
+    if (pixeldata && pooled == 1)
+    {
+        frame_pool_free(pixeldata);
+    }
+    else if (pixeldata && pooled == 0)
+    {
+#if _WIN32
+        free(pixeldata);
+#else
+        stbi_image_free(pixeldata);
+#endif
+    }
+
+    image.release();
+}
+
+class DuplicateScanParams
+{
+public:
+    const TaskPlanner* planner;
+    int tolerance;
+    int begin;
+    int end;
+    FILE* log;
+
+    // frame starting the run of frame begin - 1, -1 when unknown
+    int reference;
+
+    // states before the scan, see DuplicateCacheEntry
+    const std::vector<char>* known;
+
+    // states from frame begin on, 0 where the run is not known
+    std::vector<char> state;
+};
+
+// same size and no channel of any pixel differing by more than tolerance
+static bool same_frame(const ncnn::Mat& image0, const ncnn::Mat& image1, int tolerance)
+{
+    if (image0.w != image1.w || image0.h != image1.h || image0.elempack != image1.elempack)
+        return false;
+
+    const size_t size = (size_t)image0.w * image0.h * image0.elempack;
+    const unsigned char* p0 = (const unsigned char*)image0.data;
+    const unsigned char* p1 = (const unsigned char*)image1.data;
+
+    if (tolerance == 0)
+        return memcmp(p0, p1, size) == 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (abs(p0[i] - p1[i]) > tolerance)
+            return false;
+    }
+
+    return true;
+}
+
+// a frame differing from the frame before by more than twice the tolerance cannot be within
+// tolerance of the frame starting the run of the frame before, it always starts a run
+//
+// compares the frames from begin on with the frame starting their run. the frames before the
+// first run start found are left unknown unless the run of frame begin - 1 is known, or begin is 0.
+// the scan goes on past end up to a run start or a known frame, covering the frames the scan of
+// the following range leaves unknown
+static void* scan_duplicates(void* args)
+{
+    DuplicateScanParams* dsp = (DuplicateScanParams*)args;
+    const TaskPlanner* planner = dsp->planner;
+    const std::vector<char>& known = *dsp->known;
+    const int count = planner->count;
+
+    ncnn::Mat prev;
+    int prev_pooled = 2;
+    if (dsp->begin > 0)
+    {
+        decode_image(planner->inputpath + PATHSTR('/') + planner->filenames[dsp->begin - 1], prev, &prev_pooled, dsp->log);
+    }
+
+    // frame starting the current run, may be prev
+    ncnn::Mat ref;
+    int ref_pooled = 2;
+    bool ref_is_prev = false;
+    bool resolved = dsp->begin == 0;
+    if (dsp->reference >= 0)
+    {
+        decode_image(planner->inputpath + PATHSTR('/') + planner->filenames[dsp->reference], ref, &ref_pooled, dsp->log);
+        resolved = true;
+    }
+
+    for (int k = dsp->begin; k < count; k++)
+    {
+        if (k >= dsp->end && known[k] != 0)
+            break;
+
+        ncnn::Mat image;
+        int pooled = 2;
+        if (decode_image(planner->inputpath + PATHSTR('/') + planner->filenames[k], image, &pooled, dsp->log) != 0)
+            pooled = 2;
+
+        // a frame failing to decode starts a run, and so does the frame after it
+        const bool hard = prev.empty() || image.empty() || !same_frame(prev, image, dsp->tolerance * 2);
+
+        char state = 0;
+        if (hard)
+        {
+            state = 1;
+            resolved = true;
+        }
+        else if (resolved)
+        {
+            state = same_frame(ref, image, dsp->tolerance) ? 2 : 1;
+        }
+
+        dsp->state.push_back(state);
+
+        if (hard && k >= dsp->end)
+        {
+            release_decoded_image(image, pooled);
+            break;
+        }
+
+        // the previous frame is released unless it stays the reference
+        if (state == 1)
+        {
+            if (!ref_is_prev)
+                release_decoded_image(ref, ref_pooled);
+            release_decoded_image(prev, prev_pooled);
+
+            ref = image;
+            ref_pooled = pooled;
+            ref_is_prev = true;
+        }
+        else
+        {
+            if (!ref_is_prev)
+                release_decoded_image(prev, prev_pooled);
+            ref_is_prev = false;
+        }
+
+        prev = image;
+        prev_pooled = pooled;
+    }
+
+    if (!ref_is_prev)
+        release_decoded_image(ref, ref_pooled);
+    release_decoded_image(prev, prev_pooled);
+
+    return 0;
+}
+
+// comparisons of the source frames of image directories, kept for the later jobs and shards of the process
+#define DUPLICATE_CACHE_ENTRIES 8
+
+class DuplicateCacheEntry
+{
+public:
+    path_t inputpath;
+    std::vector<path_t> filenames;
+    int tolerance;
+
+    // 0 = not known yet, 1 = starts a run, 2 = within tolerance of the frame starting its run
+    std::vector<char> state;
+};
+
+static ncnn::Mutex duplicate_cache_lock;
+static std::vector<DuplicateCacheEntry> duplicate_cache;
+
+// finds the state of the frames begin to end - 1 not known yet, and of frames before begin
+// until the run of frame begin is known
+static void scan_duplicate_range(const TaskPlanner& planner, int tolerance, int thread_count, FILE* log, std::vector<char>& state, int begin, int end)
+{
+    int step = 16;
+
+    for (;;)
+    {
+        while (begin < end && state[begin] != 0)
+            begin++;
+        while (end > begin && state[end - 1] != 0)
+            end--;
+
+        if (begin == end)
+            return;
+
+        // known states are contiguous from a run start
+        int reference = -1;
+        if (begin > 0 && state[begin - 1] != 0)
+        {
+            reference = begin - 1;
+            while (reference > 0 && state[reference] != 1)
+                reference--;
+        }
+
+        const std::vector<char> known = state;
+
+        const int n = std::min(thread_count, end - begin);
+
+        std::vector<DuplicateScanParams> dsp(n);
+        std::vector<ncnn::Thread*> threads(n);
+        for (int i=0; i<n; i++)
+        {
+            dsp[i].planner = &planner;
+            dsp[i].tolerance = tolerance;
+            dsp[i].begin = begin + (int)((long long)(end - begin) * i / n);
+            dsp[i].end = begin + (int)((long long)(end - begin) * (i + 1) / n);
+            dsp[i].log = log;
+            dsp[i].reference = i == 0 ? reference : -1;
+            dsp[i].known = &known;
+
+            threads[i] = new ncnn::Thread(scan_duplicates, (void*)&dsp[i]);
+        }
+
+        for (int i=0; i<n; i++)
+        {
+            threads[i]->join();
+            delete threads[i];
+
+            for (size_t j=0; j<dsp[i].state.size(); j++)
+            {
+                if (dsp[i].state[j] != 0)
+                    state[dsp[i].begin + j] = dsp[i].state[j];
+            }
+        }
+
+        if (state[begin] != 0)
+            return;
+
+        // no run start before the first frame compared, go further back
+        end = begin;
+        begin = std::max(begin - step, 0);
+        step *= 2;
+    }
+}
+
+// keyframes of the planner, the first frame of every run of identical frames.
+// only the source frames of the shard are compared, and outwards until the two keyframes before
+// and the keyframe after them are found, so retime plans the shard exactly as with every keyframe
+static void find_keyframes(TaskPlanner& planner, int tolerance, int thread_count, FILE* log)
+{
+    const int count = planner.count;
+
+    std::vector<char> state;
+    {
+        duplicate_cache_lock.lock();
+
+        for (size_t i = 0; i < duplicate_cache.size(); i++)
+        {
+            const DuplicateCacheEntry& e = duplicate_cache[i];
+            if (e.inputpath == planner.inputpath && e.tolerance == tolerance && e.filenames == planner.filenames)
+            {
+                state = e.state;
+                break;
+            }
+        }
+
+        duplicate_cache_lock.unlock();
+    }
+
+    if (state.empty())
+        state.resize(count, 0);
+
+    // source frames planned by the shard
+    const double scale = (double)count / planner.numframe;
+    const int lo = std::min((int)floor(planner.shard_begin * scale), count - 1);
+    const int hi = std::max(lo, std::min((int)floor((planner.shard_end - 1) * scale), count - 1));
+
+    scan_duplicate_range(planner, tolerance, thread_count, log, state, lo, std::min(hi + 2, count));
+
+    // frames past the range are compared in growing steps
+    int step = 16;
+
+    int begin = lo;
+    for (;;)
+    {
+        int found = 0;
+        int k = lo;
+        for (; k >= begin; k--)
+        {
+            if ((k == 0 || state[k] == 1) && ++found == 2)
+                break;
+        }
+
+        if (found == 2 || begin == 0)
+        {
+            begin = std::max(k, 0);
+            break;
+        }
+
+        const int b = std::max(begin - step, 0);
+        scan_duplicate_range(planner, tolerance, thread_count, log, state, b, begin);
+        begin = b;
+        step *= 2;
+    }
+
+    int end = std::min(hi + 2, count);
+    for (;;)
+    {
+        int k = hi + 1;
+        while (k < end && state[k] != 1)
+            k++;
+
+        if (k < end)
+        {
+            end = k + 1;
+            break;
+        }
+
+        if (end == count)
+            break;
+
+        const int e = std::min(end + step, count);
+        scan_duplicate_range(planner, tolerance, thread_count, log, state, end, e);
+        end = e;
+        step *= 2;
+    }
+
+    planner.keyframes.clear();
+    for (int k=begin; k<end; k++)
+    {
+        if (k == 0 || state[k] == 1)
+            planner.keyframes.push_back(k);
+    }
+
+    {
+        duplicate_cache_lock.lock();
+
+        size_t i = 0;
+        while (i < duplicate_cache.size() && !(duplicate_cache[i].inputpath == planner.inputpath && duplicate_cache[i].tolerance == tolerance && duplicate_cache[i].filenames == planner.filenames))
+            i++;
+
+        if (i == duplicate_cache.size())
+        {
+            if (duplicate_cache.size() == DUPLICATE_CACHE_ENTRIES)
+            {
+                duplicate_cache.erase(duplicate_cache.begin());
+                i--;
+            }
+
+            duplicate_cache.push_back(DuplicateCacheEntry());
+            duplicate_cache[i].inputpath = planner.inputpath;
+            duplicate_cache[i].filenames = planner.filenames;
+            duplicate_cache[i].tolerance = tolerance;
+            duplicate_cache[i].state.resize(count, 0);
+        }
+
+        // a concurrent job may have compared other frames meanwhile
+        std::vector<char>& cached = duplicate_cache[i].state;
+        for (int k=0; k<count; k++)
+        {
+            if (state[k] != 0)
+                cached[k] = state[k];
+        }
+
+        duplicate_cache_lock.unlock();
+    }
+}
+
+// union of the picture areas of the frames sampled from the border crop window of source frame sx
+static void border_window_area(Session* session, int sx, int* area)
+{
+    BorderCrop& border_crop = session->border_crop;
+    const TaskPlanner& planner = session->planner;
+
+    area[0] = 0;
+    area[1] = 0;
+    area[2] = 0;
+    area[3] = 0;
+
+    // a single pair has no window
+    if (planner.inputpath.empty())
+        return;
+
+    const int window = sx / BORDER_CROP_WINDOW;
+    if (border_crop.window_area(window, area))
+        return;
+
+    for (int i = 0; i < BORDER_CROP_SAMPLES; i++)
+    {
+        const int k = window * BORDER_CROP_WINDOW + (2 * i + 1) * BORDER_CROP_WINDOW / (2 * BORDER_CROP_SAMPLES);
+        if (k >= planner.count)
+            break;
+
+        ncnn::Mat image;
+        int pooled = 2;
+        if (decode_image(planner.inputpath + PATHSTR('/') + planner.source_filenames()[k], image, &pooled, session->log) != 0)
+            continue;
+
+        border_union(image, border_crop.level, area);
+
+        release_decoded_image(image, pooled);
+    }
+
+    // threads measuring the same window at once store the same area
+    border_crop.set_window_area(window, area);
+}
+
+void* load_worker(void* args)
+{
+    const LoadWorkerParams* lwp = (const LoadWorkerParams*)args;
+    Session* session = lwp->session;
+    const TaskPlanner* planner = &session->planner;
+    LoadDispatcher* dispatcher = lwp->dispatcher;
+    const int count = planner->size();
+
+    for (;;)
+    {
+        const int i = dispatcher->claim();
+        if (i < 0)
+            break;
+
+        Task v;
+        v.session = session;
+        v.id = i;
+        v.pooled0 = 2;
+        v.pooled1 = 2;
+        v.hostmem = 0;
+
+        const size_t reserved = dispatcher->reserve(i);
+
+        // another worker has taken the chunk over, the remaining tasks are left to it
+        if (session->cancelled())
+        {
+            dispatcher->complete(v, 0, reserved);
+            continue;
+        }
+
+        if (session->frame_archive.is_open())
+            session->frame_archive.wait_for(i);
+
+        int sx;
+        planner->plan(i, v.in0path, v.in1path, v.outpath, v.timestep, sx);
+
+        const path_t& image0path = v.in0path;
+        const path_t& image1path = v.in1path;
+
+        // outputs are renamed into place once complete, an existing one is done.
+        // a partial file left by the interrupted run is dropped either way
+        if (session->resume)
+            remove_file(temp_filepath(v.outpath));
+
+        if (session->resume && filepath_is_readable(v.outpath))
+        {
+            dispatcher->complete(v, 0, reserved);
+            continue;
+        }
+
+#if !_WIN32
+        // let the kernel read ahead the inputs claimed next
+        if (i + session->jobs_load < count)
+        {
+            path_t next0path;
+            path_t next1path;
+            path_t nextoutpath;
+            float nexttimestep;
+            int nextsx;
+            planner->plan(i + session->jobs_load, next0path, next1path, nextoutpath, nexttimestep, nextsx);
+
+            prefetch_file(next0path);
+            prefetch_file(next1path);
+        }
+#endif
+
+        // outputs at timestep 0 or 1 are a source frame, they skip the proc stage
+        if (v.timestep == 0.f || v.timestep == 1.f)
+        {
+            const path_t& srcpath = v.timestep == 0.f ? image0path : image1path;
+
+            if (passthrough_file(srcpath, v.outpath, session->frame_archive, i) == 0)
+            {
+                if (session->verbose)
+                {
+#if _WIN32
+                    fwprintf(session->log, L"%ls -> %ls done\n", srcpath.c_str(), v.outpath.c_str());
+#else
+                    fprintf(session->log, "%s -> %s done\n", srcpath.c_str(), v.outpath.c_str());
+#endif
+                }
+                dispatcher->complete(v, 0, reserved);
+                continue;
+            }
+
+            // formats differ, decode the source alone and re-encode it
+            if (decode_image(srcpath, v.in0image, &v.pooled0, session->log) != 0)
+            {
+                session->count_failure();
+                if (session->frame_archive.is_open())
+                    session->frame_archive.skip(i);
+                dispatcher->complete(v, 0, reserved);
+                continue;
+            }
+
+            v.outimage = v.in0image;
+            v.hostmem = v.in0image.total() * v.in0image.elemsize;
+
+            dispatcher->complete(v, 2, reserved);
+            continue;
+        }
+
+        int ret0 = decode_image(image0path, v.in0image, &v.pooled0, session->log);
+        int ret1 = decode_image(image1path, v.in1image, &v.pooled1, session->log);
+
+        if (ret0 != 0 || ret1 != 0)
+        {
+            release_decoded_image(v.in0image, v.pooled0);
+            release_decoded_image(v.in1image, v.pooled1);
+
+            session->count_failure();
+            if (session->frame_archive.is_open())
+                session->frame_archive.skip(i);
+            dispatcher->complete(v, 0, reserved);
+            continue;
+        }
+
+        // interpolating across a hard cut only ghosts two unrelated frames, the nearest one is output instead
+        if (session->scene_threshold > 0.f && scene_difference(v.in0image, v.in1image) > session->scene_threshold)
+        {
+            const bool first = v.timestep < 0.5f;
+            const path_t& srcpath = first ? image0path : image1path;
+
+            if (session->verbose)
+            {
+#if _WIN32
+                fwprintf(session->log, L"%ls %ls scene cut\n", image0path.c_str(), image1path.c_str());
+#else
+                fprintf(session->log, "%s %s scene cut\n", image0path.c_str(), image1path.c_str());
+#endif
+            }
+
+            if (passthrough_file(srcpath, v.outpath, session->frame_archive, i) == 0)
+            {
+                release_decoded_image(v.in0image, v.pooled0);
+                release_decoded_image(v.in1image, v.pooled1);
+
+                dispatcher->complete(v, 0, reserved);
+                continue;
+            }
+
+            if (first)
+            {
+                release_decoded_image(v.in1image, v.pooled1);
+                v.outimage = v.in0image;
+            }
+            else
+            {
+                release_decoded_image(v.in0image, v.pooled0);
+                v.outimage = v.in1image;
+            }
+
+            v.hostmem = v.outimage.total() * v.outimage.elemsize;
+
+            dispatcher->complete(v, 2, reserved);
+            continue;
+        }
+
+        if (session->border_crop.level >= 0)
+        {
+            int window_area[4];
+            border_window_area(session, sx, window_area);
+            session->border_crop.picture_area(v.in0image, v.in1image, window_area, &v.area_x, &v.area_y, &v.area_w, &v.area_h);
+        }
+        else
+        {
+            session->border_crop.picture_area(v.in0image, v.in1image, 0, &v.area_x, &v.area_y, &v.area_w, &v.area_h);
+        }
+
+        v.outimage = ncnn::Mat(v.in0image.w, v.in0image.h, (size_t)3, 3, &frame_pool_allocator);
+        v.hostmem = v.in0image.total() * v.in0image.elemsize + v.in1image.total() * v.in1image.elemsize + v.outimage.total() * v.outimage.elemsize;
+
+        dispatcher->complete(v, 1, reserved);
+    }
+
+    return 0;
+}
+
+void* load(void* args)
+{
+    Session* session = (Session*)args;
+
+    LoadDispatcher dispatcher(session->planner.size(), session->prefetch_window);
+
+    LoadWorkerParams lwp;
+    lwp.session = session;
+    lwp.dispatcher = &dispatcher;
+
+    std::vector<ncnn::Thread*> load_threads(session->jobs_load);
+    for (int i=0; i<session->jobs_load; i++)
+    {
+        load_threads[i] = new ncnn::Thread(load_worker, (void*)&lwp);
+    }
+
+    for (int i=0; i<session->jobs_load; i++)
+    {
+        load_threads[i]->join();
+        delete load_threads[i];
+    }
+
+    return 0;
+}
+
+#if USE_LIBAV
+void* load_video(void* args)
+{
+    Session* session = (Session*)args;
+    const TaskPlanner* planner = &session->planner;
+    VideoDecoder* video = &session->video;
+    const int count = planner->size();
+
+    // sliding pair of decoded frames, shared by every output between them
+    ncnn::Mat frame0;
+    ncnn::Mat frame1;
+    double pts0 = 0.0;
+    double pts1 = 0.0;
+    int frame0_index = 0;
+
+    // scene cut between frame0 and frame1, detected once per pair
+    int cut_index = -1;
+    bool cut = false;
+
+    // host memory acquired for a task before its frames are decoded, the largest task seen so far
+    size_t estimate = 0;
+
+    // a shard starts at its first source frame, the frames before are decoded for reference only
+    if (count > 0)
+    {
+        path_t in0path;
+        path_t in1path;
+        path_t outpath;
+        float timestep;
+        int first_sx;
+        planner->plan(0, in0path, in1path, outpath, timestep, first_sx);
+
+        for (; frame0_index < first_sx; frame0_index++)
+        {
+            if (video->skip() != 0)
+            {
+                fprintf(session->log, "decode video failed\n");
+                session->count_failure();
+                return 0;
+            }
+        }
+    }
+
+    if (video->read(frame0, &frame_pool_allocator, &pts0) != 0 || video->read(frame1, &frame_pool_allocator, &pts1) != 0)
+    {
+        fprintf(session->log, "decode video failed\n");
+        session->count_failure();
+        return 0;
+    }
+
+    for (int i=0; i<count; i++)
+    {
+        Task v;
+        v.session = session;
+        v.id = i;
+
+        int sx;
+        planner->plan(i, v.in0path, v.in1path, v.outpath, v.timestep, sx);
+
+        if (session->frame_archive.is_open())
+            session->frame_archive.wait_for(i);
+
+        // before decoding, the frames are then held until saved
+        host_memory_budget.acquire(estimate);
+
+        bool eof = false;
+        while (frame0_index < sx)
+        {
+            frame0 = frame1;
+            pts0 = pts1;
+            frame0_index++;
+
+            ncnn::Mat next;
+            if (video->read(next, &frame_pool_allocator, &pts1) != 0)
+            {
+                eof = true;
+                break;
+            }
+            frame1 = next;
+        }
+
+        // fewer frames than the container advertised
+        if (eof)
+        {
+            host_memory_budget.release(estimate);
+
+            fprintf(session->log, "video has only %d frames, the last %d outputs are not generated\n", frame0_index + 1, count - i);
+
+            // the archive must not wait for them
+            if (session->frame_archive.is_open())
+            {
+                for (int j = i; j < count; j++)
+                    session->frame_archive.skip(j);
+            }
+            break;
+        }
+
+        if (session->resume)
+            remove_file(temp_filepath(v.outpath));
+
+        if (session->resume && filepath_is_readable(v.outpath))
+        {
+            host_memory_budget.release(estimate);
+            continue;
+        }
+
+        v.pooled0 = 2;
+        v.pooled1 = 2;
+        v.frame0 = sx;
+        v.frame1 = sx + 1;
+        // between the timestamps of the pair, variable frame rate sources included
+        v.pts = pts0 + v.timestep * (pts1 - pts0);
+
+        v.in0image = frame0;
+        v.in1image = frame1;
+
+        if (session->scene_threshold > 0.f && cut_index != frame0_index)
+        {
+            cut_index = frame0_index;
+            cut = scene_difference(frame0, frame1) > session->scene_threshold;
+
+            if (cut && session->verbose)
+            {
+#if _WIN32
+                fwprintf(session->log, L"%ls #%d #%d scene cut\n", v.in0path.c_str(), v.frame0, v.frame1);
+#else
+                fprintf(session->log, "%s #%d #%d scene cut\n", v.in0path.c_str(), v.frame0, v.frame1);
+#endif
+            }
+        }
+
+        // outputs at timestep 0 or 1 are a decoded frame, they skip the proc stage,
+        // as do outputs across a hard cut, which repeat the nearest frame
+        if (v.timestep == 0.f || v.timestep == 1.f || cut)
+        {
+            v.outimage = v.timestep < 0.5f ? frame0 : frame1;
+
+            v.hostmem = v.outimage.total() * v.outimage.elemsize;
+            host_memory_budget.adjust(estimate, v.hostmem);
+
+            session->tosave.put(v);
+            continue;
+        }
+
+        // frames of a video are not sampled out of order, the pair alone is measured
+        session->border_crop.picture_area(frame0, frame1, 0, &v.area_x, &v.area_y, &v.area_w, &v.area_h);
+
+        v.outimage = ncnn::Mat(frame0.w, frame0.h, (size_t)3, 3, &frame_pool_allocator);
+
+        v.hostmem = v.in0image.total() * v.in0image.elemsize + v.in1image.total() * v.in1image.elemsize + v.outimage.total() * v.outimage.elemsize;
+        host_memory_budget.adjust(estimate, v.hostmem);
+        estimate = std::max(estimate, v.hostmem);
+
+        toproc.put(session->id, v);
+    }
+
+    return 0;
+}
+#endif // USE_LIBAV
+
+class ProcThreadParams
+{
+public:
+    // all instances, frames of a split_frame session go to every gpu
+    const std::vector<DAIN*>* dain;
+    int device;
+};
+
+class SplitThreadParams
+{
+public:
+    const DAIN* dain;
+    const Task* task;
+    ncnn::Mat* outimage;
+    DAINRows* rows;
+    // milliseconds until the rows ran out
+    double band_time;
+};
+
+static void* process_rows(void* args)
+{
+    SplitThreadParams* stp = (SplitThreadParams*)args;
+    const Task* v = stp->task;
+
+    const double start = ncnn::get_current_time();
+
+    stp->dain->process(v->in0image, v->in1image, v->timestep, *stp->outimage, *stp->rows, v->area_x, v->area_y, v->area_w, v->area_h, v->session->static_tolerance);
+
+    stp->band_time = ncnn::get_current_time() - start;
+
+    return 0;
+}
+
+// every gpu claims tile rows of the same frame in its own tile size,
+// so faster gpus end up with more rows, band_times of every gpu
+static void process_split(const std::vector<DAIN*>& dain, int device, Task& v, std::vector<double>& band_times)
+{
+    DAINRows rows;
+
+    std::vector<SplitThreadParams> stp(dain.size());
+    std::vector<ncnn::Thread*> threads(dain.size(), (ncnn::Thread*)0);
+    for (size_t i=0; i<dain.size(); i++)
+    {
+        stp[i].dain = dain[i];
+        stp[i].task = &v;
+        stp[i].outimage = &v.outimage;
+        stp[i].rows = &rows;
+        stp[i].band_time = 0;
+
+        if ((int)i != device)
+            threads[i] = new ncnn::Thread(process_rows, (void*)&stp[i]);
+    }
+
+    process_rows((void*)&stp[device]);
+
+    for (size_t i=0; i<dain.size(); i++)
+    {
+        if (threads[i])
+        {
+            threads[i]->join();
+            delete threads[i];
+        }
+    }
+
+    band_times.resize(dain.size());
+    for (size_t i=0; i<dain.size(); i++)
+    {
+        band_times[i] = stp[i].band_time;
+    }
+}
+
+void* proc(void* args)
+{
+    const ProcThreadParams* ptp = (const ProcThreadParams*)args;
+    const std::vector<DAIN*>& dain = *ptp->dain;
+
+    for (;;)
+    {
+        Task v;
+
+        if (!toproc.get(ptp->device, v))
+            break;
+
+        const double start = ncnn::get_current_time();
+
+        std::vector<double> band_times;
+        if (v.session->split_frame && dain.size() > 1)
+        {
+            process_split(dain, ptp->device, v, band_times);
+        }
+        else
+        {
+            DAINRows rows;
+            dain[ptp->device]->process(v.in0image, v.in1image, v.timestep, v.outimage, rows, v.area_x, v.area_y, v.area_w, v.area_h, v.session->static_tolerance);
+        }
+
+        const double frame_time = ncnn::get_current_time() - start;
+
+        // the session may be gone once its lane drains, report last
+        const int lane = v.session->id;
+        v.session->tosave.put(v);
+
+        if (band_times.empty())
+            toproc.report(ptp->device, lane, frame_time);
+        else
+            toproc.report_split(ptp->device, lane, band_times);
+    }
+
+    return 0;
+}
+
+static path_t progress_line(const Task& v)
+{
+#if _WIN32
+    std::vector<wchar_t> line(v.in0path.size() + v.in1path.size() + v.outpath.size() + 128);
+    if (v.pooled0 == 2)
+        swprintf(line.data(), line.size(), L"%ls #%d #%d %f -> %ls %.3fs done\n", v.in0path.c_str(), v.frame0, v.frame1, v.timestep, v.outpath.c_str(), v.pts);
+    else
+        swprintf(line.data(), line.size(), L"%ls %ls %f -> %ls done\n", v.in0path.c_str(), v.in1path.c_str(), v.timestep, v.outpath.c_str());
+#else
+    std::vector<char> line(v.in0path.size() + v.in1path.size() + v.outpath.size() + 128);
+    if (v.pooled0 == 2)
+        snprintf(line.data(), line.size(), "%s #%d #%d %f -> %s %.3fs done\n", v.in0path.c_str(), v.frame0, v.frame1, v.timestep, v.outpath.c_str(), v.pts);
+    else
+        snprintf(line.data(), line.size(), "%s %s %f -> %s done\n", v.in0path.c_str(), v.in1path.c_str(), v.timestep, v.outpath.c_str());
+#endif
+
+    return line.data();
+}
+
+void* save(void* args)
+{
+    Session* session = (Session*)args;
+    const int verbose = session->verbose;
+
+    for (;;)
+    {
+        Task v;
+
+        session->tosave.get(v);
+
+        if (v.id == -233)
+            break;
+
+        // progress line, printed once the output is written
+        path_t done;
+        if (verbose)
+        {
+            done = progress_line(v);
+        }
+
+        int ret = encode_image(v.outpath, v.outimage, session->encode_options, session->file_writer, session->frame_archive, v.id, done, session->log);
+
+        // free input pixel data
+        release_decoded_image(v.in0image, v.pooled0);
+        release_decoded_image(v.in1image, v.pooled1);
+
+        v.outimage.release();
+        host_memory_budget.release(v.hostmem);
+
+        if (ret < 0)
+        {
+            session->count_failure();
+        }
+        else if (ret == 0 && verbose)
+        {
+#if _WIN32
+            fputws(done.c_str(), session->log);
+#else
+            fputs(done.c_str(), session->log);
+#endif
+        }
+    }
+
+    return 0;
+}
+
+
+// validates a job and plans its tasks, errors are reported to session.log
+static int setup_session(const JobOptions& job, Session& session)
+{
+    FILE* log = session.log;
+
+    if (((job.input0path.empty() || job.input1path.empty()) && job.inputpath.empty()) || job.outputpath.empty())
+    {
+        fprintf(log, "missing input or output path\n");
+        return -1;
+    }
+
+    if (job.inputpath.empty() && (job.timestep <= 0.f || job.timestep >= 1.f))
+    {
+        fprintf(log, "invalid timestep argument, must be 0~1\n");
+        return -1;
+    }
+
+    if (!job.inputpath.empty() && job.numframe < 0)
+    {
+        fprintf(log, "invalid numframe argument, must not be negative\n");
+        return -1;
+    }
+
+    if (job.jobs_load < 1 || job.jobs_save < 1)
+    {
+        fprintf(log, "invalid thread count argument\n");
+        return -1;
+    }
+
+    if (job.shard_count < 1 || job.shard_index < 0 || job.shard_index >= job.shard_count)
+    {
+        fprintf(log, "invalid shard argument, must be k/N with 0 <= k < N\n");
+        return -1;
+    }
+
+    if (job.scene_threshold < 0.f || job.scene_threshold > 1.f)
+    {
+        fprintf(log, "invalid scene threshold argument, must be 0~1\n");
+        return -1;
+    }
+
+    if (job.dup_tolerance < -1 || job.dup_tolerance > 255)
+    {
+        fprintf(log, "invalid duplicate tolerance argument, must be 0~255 or -1 for off\n");
+        return -1;
+    }
+
+    if (job.border_level < -1 || job.border_level > 255)
+    {
+        fprintf(log, "invalid border level argument, must be -1~255\n");
+        return -1;
+    }
+
+    if (job.static_tolerance < -1 || job.static_tolerance > 255)
+    {
+        fprintf(log, "invalid static-tolerance argument, must be -1~255\n");
+        return -1;
+    }
+
+    if (job.shard_count > 1 && job.inputpath.empty())
+    {
+        fprintf(log, "shard needs input-path\n");
+        return -1;
+    }
+
+    const path_t& inputpath = job.inputpath;
+    const path_t& outputpath = job.outputpath;
+    path_t pattern_format = job.pattern_format;
+
+    path_t pattern = get_file_name_without_extension(pattern_format);
+    path_t format = get_file_extension(pattern_format);
+
+    // split png:1 into format and format options
+    path_t format_options;
+    {
+        size_t colon = pattern_format.find(PATHSTR(':'));
+        if (colon != path_t::npos && colon > pattern_format.rfind(PATHSTR('.')) + 1)
+        {
+            format_options = pattern_format.substr(colon + 1);
+            pattern_format = pattern_format.substr(0, colon);
+
+            pattern = get_file_name_without_extension(pattern_format);
+            format = get_file_extension(pattern_format);
+        }
+    }
+
+    if (format.empty())
+    {
+        pattern = PATHSTR("%08d");
+        format = pattern_format;
+    }
+
+    if (pattern.empty())
+    {
+        pattern = PATHSTR("%08d");
+    }
+
+    // all output frames appended to one tar stream, named by pattern-format
+    path_t output_ext = get_file_extension(outputpath);
+    const bool archive_output = !inputpath.empty() && (output_ext == PATHSTR("tar") || output_ext == PATHSTR("TAR"));
+
+    if (!path_is_directory(outputpath) && !archive_output)
+    {
+        // guess format from outputpath no matter what format argument specified
+        path_t ext = get_file_extension(outputpath);
+
+        if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
+        {
+            format = PATHSTR("png");
+        }
+        else if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
+        {
+            format = PATHSTR("webp");
+        }
+        else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
+        {
+            format = PATHSTR("jpg");
+        }
+        else if (ext == PATHSTR("qoi") || ext == PATHSTR("QOI"))
+        {
+            format = PATHSTR("qoi");
+        }
+        else if (ext == PATHSTR("pam") || ext == PATHSTR("PAM"))
+        {
+            format = PATHSTR("pam");
+        }
+        else if (ext == PATHSTR("ppm") || ext == PATHSTR("PPM"))
+        {
+            format = PATHSTR("ppm");
+        }
+        else
+        {
+            fprintf(log, "invalid outputpath extension type\n");
+            return -1;
+        }
+    }
+
+    if (format != PATHSTR("png") && format != PATHSTR("webp") && format != PATHSTR("jpg") && format != PATHSTR("qoi") && format != PATHSTR("pam") && format != PATHSTR("ppm"))
+    {
+        fprintf(log, "invalid format argument\n");
+        return -1;
+    }
+
+#if _WIN32 && !USE_TURBOJPEG
+    // wic encoders write their own files
+    if (archive_output && (format == PATHSTR("png") || format == PATHSTR("jpg")))
+    {
+        fprintf(log, "tar output supports webp/qoi/pam/ppm format\n");
+        return -1;
+    }
+#elif _WIN32
+    if (archive_output && format == PATHSTR("png"))
+    {
+        fprintf(log, "tar output supports jpg/webp/qoi/pam/ppm format\n");
+        return -1;
+    }
+#endif
+
+    if (parse_format_options(format, format_options, session.encode_options) != 0)
+    {
+        fprintf(log, "invalid format options argument\n");
+        return -1;
+    }
+
+#if !_WIN32 && !USE_LIBDEFLATE
+    // stb_image_write compresses at one process wide level, a server job cannot change it
+    if (session.id != 0 && format == PATHSTR("png"))
+    {
+        if (!format_options.empty() && session.encode_options.png_level != stbi_write_png_compression_level)
+        {
+            fprintf(log, "png level of a server job must be the level of the server, %d\n", stbi_write_png_compression_level);
+            return -1;
+        }
+
+        session.encode_options.png_level = stbi_write_png_compression_level;
+    }
+#endif
+
+    int cpu_count = std::max(1, ncnn::get_cpu_count());
+    session.jobs_load = std::min(job.jobs_load, cpu_count);
+    session.jobs_save = std::min(job.jobs_save, cpu_count);
+    session.prefetch_window = session.jobs_load * 2 + 2;
+    session.verbose = job.verbose;
+    session.resume = job.resume;
+    session.scene_threshold = job.scene_threshold;
+    session.border_crop.level = job.border_level;
+    session.static_tolerance = job.static_tolerance;
+    session.archive_output = archive_output;
+
+    // input and output filepaths are planned on demand
+    TaskPlanner& planner = session.planner;
+    bool video_input = false;
+#if USE_LIBAV
+    video_input = !inputpath.empty() && !path_is_directory(inputpath) && filepath_is_readable(inputpath);
+#endif
+    {
+        if (!inputpath.empty() && (path_is_directory(inputpath) || video_input) && (path_is_directory(outputpath) || archive_output))
+        {
+            int count = 0;
+#if USE_LIBAV
+            if (video_input)
+            {
+                // frames are decoded in the load stage, nothing touches the disk.
+                // a single load thread feeds the pipeline, the decoder threads itself
+                session.video.log = log;
+                if (session.video.open(inputpath, 0) != 0)
+                    return -1;
+
+                count = session.video.frame_count();
+            }
+            else
+#endif
+            {
+                int lr = list_directory(inputpath, planner.filenames);
+                if (lr != 0)
+                    return -1;
+
+                count = planner.filenames.size();
+            }
+
+            planner.inputpath = inputpath;
+            planner.count = count;
+            planner.video_input = video_input;
+            planner.outputpath = outputpath;
+            planner.pattern = pattern;
+            planner.format = format;
+            planner.archive_output = archive_output;
+            planner.numframe = job.numframe == 0 ? count * 2 : job.numframe;
+
+            // contiguous output ranges, every shard plans the frames of its range exactly as a single run
+            planner.shard_begin = (int)((long long)planner.numframe * job.shard_index / job.shard_count);
+            planner.shard_end = (int)((long long)planner.numframe * (job.shard_index + 1) / job.shard_count);
+
+            // held frames are collapsed, outputs are retimed between the distinct frames
+            if (job.dup_tolerance >= 0 && !video_input && count > 0)
+            {
+                find_keyframes(planner, job.dup_tolerance, session.jobs_load, log);
+
+                if (job.verbose)
+                {
+                    fprintf(log, "%d distinct source frames around the shard\n", (int)planner.keyframes.size());
+                }
+            }
+        }
+        else if (inputpath.empty() && !path_is_directory(job.input0path) && !path_is_directory(job.input1path) && !path_is_directory(outputpath))
+        {
+            planner.input0path = job.input0path;
+            planner.input1path = job.input1path;
+            planner.outputpath = outputpath;
+            planner.timestep = job.timestep;
+        }
+        else
+        {
+            fprintf(log, "input0path, input1path and outputpath must be file at the same time\n");
+            fprintf(log, "inputpath and outputpath must be directory at the same time\n");
+            fprintf(log, "or outputpath must be tar file with inputpath\n");
+            return -1;
+        }
+    }
+
+    session.video_input = video_input;
+
+    // a single pair leaves all but one gpu idle, split the frame instead
+    session.split_frame = planner.inputpath.empty();
+
+    if (job.dup_tolerance >= 0 && video_input)
+    {
+        fprintf(log, "duplicate frames are detected in image directories only\n");
+        return -1;
+    }
+
+    if (job.resume && archive_output)
+    {
+        fprintf(log, "resume needs file or directory output\n");
+        return -1;
+    }
+
+    if (host_memory_budget.budget > 0)
+    {
+        // queue depth follows the frame size, the budget does the throttling
+        session.tosave.max_length = 0;
+    }
+
+    return 0;
+}
+
+// load and save stages of the session around the shared proc threads, returns once every output is written
+static int run_session(Session& session)
+{
+    session.file_writer.log = session.log;
+    session.frame_archive.log = session.log;
+
+    if (session.archive_output)
+    {
+        if (session.frame_archive.open(session.planner.outputpath) != 0)
+        {
+            session.set_loaded();
+            return -1;
+        }
+    }
+    else
+    {
+        session.file_writer.start(session.jobs_save);
+    }
+
+    toproc.open_lane(session.id);
+
+    // save image
+    std::vector<ncnn::Thread*> save_threads(session.jobs_save);
+    for (int i=0; i<session.jobs_save; i++)
+    {
+        save_threads[i] = new ncnn::Thread(save, (void*)&session);
+    }
+
+    // load image
+    {
+#if USE_LIBAV
+        ncnn::Thread load_thread(session.video_input ? load_video : load, (void*)&session);
+#else
+        ncnn::Thread load_thread(load, (void*)&session);
+#endif
+
+        load_thread.join();
+    }
+
+    session.set_loaded();
+
+    // end
+    toproc.close_lane(session.id);
+    toproc.wait_lane(session.id);
+
+    Task end;
+    end.id = -233;
+
+    for (int i=0; i<session.jobs_save; i++)
+    {
+        session.tosave.put(end);
+    }
+
+    for (int i=0; i<session.jobs_save; i++)
+    {
+        save_threads[i]->join();
+        delete save_threads[i];
+    }
+
+    session.file_writer.finish();
+    session.frame_archive.close();
+
+    // the renames of the outputs, their data was synced before
+    if (!session.archive_output && !session.split_frame)
+        sync_directory(session.planner.outputpath);
+
+    const int failures = session.failures + session.file_writer.failures() + session.frame_archive.failures();
+    if (failures > 0)
+    {
+        fprintf(session.log, "%d outputs failed\n", failures);
+        return -1;
+    }
+
+    return 0;
+}
+
+// session of the outputs begin to end - 1 of the job set up in whole, nothing is listed or planned again
+static void setup_chunk_session(const Session& whole, Session& session, int begin, int end)
+{
+    session.jobs_load = whole.jobs_load;
+    session.jobs_save = whole.jobs_save;
+    session.prefetch_window = whole.prefetch_window;
+    session.verbose = whole.verbose;
+    session.resume = whole.resume;
+    session.scene_threshold = whole.scene_threshold;
+    session.border_crop.level = whole.border_crop.level;
+    session.static_tolerance = whole.static_tolerance;
+    session.encode_options = whole.encode_options;
+    session.archive_output = whole.archive_output;
+    session.video_input = whole.video_input;
+    session.split_frame = whole.split_frame;
+    session.log = whole.log;
+    session.tosave.max_length = whole.tosave.max_length;
+
+    session.planner.plan_chunk(whole.planner, begin, end);
+}
+
+// a chunk of the work queue running through its own session and lane
+class ChunkRun
+{
+public:
+    Session session;
+    int ret;
+    ncnn::Thread* thread;
+};
+
+static void* run_chunk(void* args)
+{
+    ChunkRun* run = (ChunkRun*)args;
+    run->ret = run_session(run->session);
+    return 0;
+}
+
+// joins the run, marks its chunk done or gives it back, -1 when it failed
+static int finish_chunk(WorkQueue& queue, ChunkRun* run, int chunk_count)
+{
+    run->thread->join();
+    delete run->thread;
+
+    const int chunk = run->session.chunk;
+    const int ret = run->ret;
+    const int verbose = run->session.verbose;
+
+    delete run;
+
+    if (ret != 0)
+    {
+        queue.release(chunk);
+        return -1;
+    }
+
+    if (queue.complete(chunk) != 0)
+    {
+        fprintf(stderr, "chunk %d/%d was taken over by another worker\n", chunk, chunk_count);
+        return 0;
+    }
+
+    if (verbose)
+    {
+        fprintf(stderr, "chunk %d/%d done\n", chunk, chunk_count);
+    }
+
+    return 0;
+}
+
+// claims chunks of the job from the shared job directory until every chunk is done.
+// each chunk runs through its own session planned from whole, the next chunk is claimed
+// and loaded once the tasks of the previous one are queued, so the gpus never drain between chunks
+static int run_work_queue(const path_t& jobdir, const Session& whole, int chunk_count)
+{
+    WorkQueue queue;
+    if (queue.open(jobdir, chunk_count) != 0)
+        return -1;
+
+    const int numframe = whole.planner.numframe;
+
+    // oldest first, at most the one still in proc and the one loading
+    std::vector<ChunkRun*> runs;
+
+    int ret = 0;
+    for (;;)
+    {
+        bool takeover = false;
+        const int chunk = queue.claim(&takeover, runs.empty());
+        if (chunk == -1)
+            break;
+
+        if (chunk == -2)
+        {
+            // the remaining chunks belong to others, finish ours before waiting for them
+            ret = finish_chunk(queue, runs.front(), chunk_count);
+            runs.erase(runs.begin());
+            if (ret != 0)
+                break;
+            continue;
+        }
+
+        ChunkRun* run = new ChunkRun;
+        setup_chunk_session(whole, run->session, (int)((long long)numframe * chunk / chunk_count), (int)((long long)numframe * (chunk + 1) / chunk_count));
+        run->session.id = chunk + 1;
+        run->session.work_queue = &queue;
+        run->session.chunk = chunk;
+
+        // outputs left by a crashed worker are complete or absent, only the missing ones are redone
+        if (takeover)
+            run->session.resume = 1;
+
+        run->ret = 0;
+        run->thread = new ncnn::Thread(run_chunk, (void*)run);
+        runs.push_back(run);
+
+        run->session.wait_loaded();
+
+        while (runs.size() > 1)
+        {
+            ret = finish_chunk(queue, runs.front(), chunk_count);
+            runs.erase(runs.begin());
+            if (ret != 0)
+                break;
+        }
+
+        if (ret != 0)
+            break;
+    }
+
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (finish_chunk(queue, runs[i], chunk_count) != 0)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+#if !_WIN32
+// jobs arrive as "option value" lines named after the command line options,
+// ended by an empty line, e.g. "i /data/in" "o /data/out" "j 1:2"
+static void write_job(FILE* fp, const JobOptions& job)
+{
+    if (!job.input0path.empty())
+        fprintf(fp, "0 %s\n", job.input0path.c_str());
+    if (!job.input1path.empty())
+        fprintf(fp, "1 %s\n", job.input1path.c_str());
+    if (!job.inputpath.empty())
+        fprintf(fp, "i %s\n", job.inputpath.c_str());
+    fprintf(fp, "o %s\n", job.outputpath.c_str());
+    fprintf(fp, "n %d\n", job.numframe);
+    fprintf(fp, "s %.9g\n", job.timestep);
+    fprintf(fp, "j %d:%d\n", job.jobs_load, job.jobs_save);
+    fprintf(fp, "f %s\n", job.pattern_format.c_str());
+    fprintf(fp, "r %d\n", job.resume);
+    fprintf(fp, "S %d/%d\n", job.shard_index, job.shard_count);
+    fprintf(fp, "x %.9g\n", job.scene_threshold);
+    fprintf(fp, "u %d\n", job.dup_tolerance);
+    fprintf(fp, "b %d\n", job.border_level);
+    fprintf(fp, "k %d\n", job.static_tolerance);
+    fprintf(fp, "v %d\n", job.verbose);
+    fprintf(fp, "\n");
+    fflush(fp);
+}
+
+static int read_job(FILE* fp, JobOptions& job)
+{
+    char line[4096];
+    while (fgets(line, sizeof(line), fp))
+    {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+
+        if (len == 0)
+            return 0;
+
+        if (len < 2 || line[1] != ' ')
+            return -1;
+
+        const char* value = line + 2;
+        switch (line[0])
+        {
+        case '0':
+            job.input0path = value;
+            break;
+        case '1':
+            job.input1path = value;
+            break;
+        case 'i':
+            job.inputpath = value;
+            break;
+        case 'o':
+            job.outputpath = value;
+            break;
+        case 'n':
+            job.numframe = atoi(value);
+            break;
+        case 's':
+            job.timestep = atof(value);
+            break;
+        case 'j':
+            sscanf(value, "%d:%d", &job.jobs_load, &job.jobs_save);
+            break;
+        case 'f':
+            job.pattern_format = value;
+            break;
+        case 'r':
+            job.resume = atoi(value);
+            break;
+        case 'S':
+            sscanf(value, "%d/%d", &job.shard_index, &job.shard_count);
+            break;
+        case 'x':
+            job.scene_threshold = atof(value);
+            break;
+        case 'u':
+            job.dup_tolerance = atoi(value);
+            break;
+        case 'b':
+            job.border_level = atoi(value);
+            break;
+        case 'k':
+            job.static_tolerance = atoi(value);
+            break;
+        case 'v':
+            job.verbose = atoi(value);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    // connection closed before the end of the job
+    return -1;
+}
 
-class TaskQueue
+class ClientThreadParams
 {
 public:
-    TaskQueue()
+    int fd;
+    int id;
+};
+
+// runs one job per connection, progress streams back and the last line is "exit <status>"
+static void* serve_client(void* args)
+{
+    ClientThreadParams* ctp = (ClientThreadParams*)args;
+
+    FILE* in = fdopen(ctp->fd, "r");
+    FILE* out = fdopen(dup(ctp->fd), "w");
+    setvbuf(out, NULL, _IOLBF, 0);
+
+    int ret = -1;
+
+    JobOptions job;
+    if (read_job(in, job) != 0)
     {
+        fprintf(out, "invalid job request\n");
     }
-
-    void put(const Task& v)
+    else
     {
-        lock.lock();
+        Session* session = new Session;
+        session->id = ctp->id;
+        session->log = out;
 
-        while (tasks.size() >= 8) // FIXME hardcode queue length
+        ret = setup_session(job, *session);
+        if (ret == 0)
         {
-            condition.wait(lock);
+            ret = run_session(*session);
         }
 
-        tasks.push(v);
-
-        lock.unlock();
-
-        condition.signal();
+        delete session;
     }
 
-    void get(Task& v)
-    {
-        lock.lock();
+    fprintf(out, "exit %d\n", ret);
 
-        while (tasks.size() == 0)
-        {
-            condition.wait(lock);
-        }
+    fclose(out);
+    fclose(in);
+    delete ctp;
 
-        v = tasks.front();
-        tasks.pop();
+    return 0;
+}
 
-        lock.unlock();
+// accepts jobs on a unix domain socket until killed, every connection gets its own session
+static int serve(const char* socketpath)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-        condition.signal();
-    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketpath, sizeof(addr.sun_path) - 1);
 
-private:
-    ncnn::Mutex lock;
-    ncnn::ConditionVariable condition;
-    std::queue<Task> tasks;
-};
+    // a socket left behind by a previous server
+    unlink(socketpath);
 
-TaskQueue toproc;
-TaskQueue tosave;
+    // jobs read and write files as the server user, only that user may connect.
+    // the socket is created with these permissions, there is no window before a chmod
+    mode_t mask = umask(0177);
+    int br = fd < 0 ? -1 : bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
 
-class LoadThreadParams
-{
-public:
-    int jobs_load;
+    if (br != 0 || listen(fd, 16) != 0)
+    {
+        fprintf(stderr, "listen on %s failed\n", socketpath);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
 
-    // session data
-    std::vector<path_t> input0_files;
-    std::vector<path_t> input1_files;
-    std::vector<path_t> output_files;
-    std::vector<float> timesteps;
-};
+    // a client going away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
 
-void* load(void* args)
-{
-    const LoadThreadParams* ltp = (const LoadThreadParams*)args;
-    const int count = ltp->output_files.size();
+    fprintf(stderr, "listening on %s\n", socketpath);
 
-    #pragma omp parallel for schedule(static,1) num_threads(ltp->jobs_load)
-    for (int i=0; i<count; i++)
+    for (int id = 1; ; id++)
     {
-        const path_t& image0path = ltp->input0_files[i];
-        const path_t& image1path = ltp->input1_files[i];
+        int client = accept(fd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
 
-        Task v;
-        v.id = i;
-        v.in0path = image0path;
-        v.in1path = image1path;
-        v.outpath = ltp->output_files[i];
-        v.timestep = ltp->timesteps[i];
+            fprintf(stderr, "accept on %s failed\n", socketpath);
+            break;
+        }
 
-        int ret0 = decode_image(image0path, v.in0image, &v.webp0);
-        int ret1 = decode_image(image1path, v.in1image, &v.webp1);
+        ClientThreadParams* ctp = new ClientThreadParams;
+        ctp->fd = client;
+        ctp->id = id;
 
-        if (ret0 != 0 || ret1 != 1)
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_client, (void*)ctp) != 0)
         {
-            v.outimage = ncnn::Mat(v.in0image.w, v.in0image.h, (size_t)3, 3);
-            toproc.put(v);
+            close(client);
+            delete ctp;
+            continue;
         }
+
+        pthread_detach(thread);
     }
 
-    return 0;
+    close(fd);
+    unlink(socketpath);
+
+    return -1;
 }
 
-class ProcThreadParams
+static path_t absolute_path(const path_t& path)
 {
-public:
-    const DAIN* dain;
-};
+    if (path.empty() || path[0] == '/')
+        return path;
 
-void* proc(void* args)
-{
-    const ProcThreadParams* ptp = (const ProcThreadParams*)args;
-    const DAIN* dain = ptp->dain;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+        return path;
 
-    for (;;)
-    {
-        Task v;
+    return path_t(cwd) + '/' + path;
+}
 
-        toproc.get(v);
+// hands the job to a running server and relays its output, returns the job status
+static int submit_job(const char* socketpath, JobOptions job)
+{
+    // the server resolves paths from its own working directory
+    job.input0path = absolute_path(job.input0path);
+    job.input1path = absolute_path(job.input1path);
+    job.inputpath = absolute_path(job.inputpath);
+    job.outputpath = absolute_path(job.outputpath);
 
-        if (v.id == -233)
-            break;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-        dain->process(v.in0image, v.in1image, v.timestep, v.outimage);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketpath, sizeof(addr.sun_path) - 1);
 
-        tosave.put(v);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "connect to %s failed\n", socketpath);
+        if (fd >= 0)
+            close(fd);
+        return -1;
     }
 
-    return 0;
-}
+    FILE* out = fdopen(dup(fd), "w");
+    write_job(out, job);
+    fclose(out);
 
-class SaveThreadParams
-{
-public:
-    int verbose;
-};
+    FILE* in = fdopen(fd, "r");
 
-void* save(void* args)
-{
-    const SaveThreadParams* stp = (const SaveThreadParams*)args;
-    const int verbose = stp->verbose;
+    int ret = -1;
 
-    for (;;)
+    char line[4096];
+    while (fgets(line, sizeof(line), in))
     {
-        Task v;
-
-        tosave.get(v);
-
-        if (v.id == -233)
+        if (sscanf(line, "exit %d", &ret) == 1)
             break;
 
-        int ret = encode_image(v.outpath, v.outimage);
-
-        // free input pixel data
-        {
-            unsigned char* pixeldata = (unsigned char*)v.in0image.data;
-            if (v.webp0 == 1)
-            {
-                free(pixeldata);
-            }
-            else
-            {
-#if _WIN32
-                free(pixeldata);
-#else
-                stbi_image_free(pixeldata);
-#endif
-            }
-        }
-        {
-            unsigned char* pixeldata = (unsigned char*)v.in1image.data;
-            if (v.webp1 == 1)
-            {
-                free(pixeldata);
-            }
-            else
-            {
-#if _WIN32
-                free(pixeldata);
-#else
-                stbi_image_free(pixeldata);
-#endif
-            }
-        }
-
-        if (ret == 0)
-        {
-            if (verbose)
-            {
-#if _WIN32
-                fwprintf(stderr, L"%ls %ls %f -> %ls done\n", v.in0path.c_str(), v.in1path.c_str(), v.timestep, v.outpath.c_str());
-#else
-                fprintf(stderr, "%s %s %f -> %s done\n", v.in0path.c_str(), v.in1path.c_str(), v.timestep, v.outpath.c_str());
-#endif
-            }
-        }
+        fputs(line, stderr);
     }
 
-    return 0;
-}
+    fclose(in);
 
+    return ret;
+}
+#endif // _WIN32
 
 #if _WIN32
 int wmain(int argc, wchar_t** argv)
@@ -440,45 +3233,42 @@ int wmain(int argc, wchar_t** argv)
 int main(int argc, char** argv)
 #endif
 {
-    path_t input0path;
-    path_t input1path;
-    path_t inputpath;
-    path_t outputpath;
-    int numframe = 0;
-    float timestep = 0.5f;
+    JobOptions job;
     std::vector<int> tilesize;
     path_t model = PATHSTR("best");
     std::vector<int> gpuid;
-    int jobs_load = 1;
     std::vector<int> jobs_proc;
-    int jobs_save = 2;
-    int verbose = 0;
-    path_t pattern_format = PATHSTR("%08d.png");
+    size_t max_host_mem = 0;
+    path_t jobdir;
+#if !_WIN32
+    std::string serverpath;
+    std::string clientpath;
+#endif
 
 #if _WIN32
     setlocale(LC_ALL, "");
     wchar_t opt;
-    while ((opt = getopt(argc, argv, L"0:1:i:o:n:s:t:m:g:j:f:vh")) != (wchar_t)-1)
+    while ((opt = getopt(argc, argv, L"0:1:i:o:n:s:t:k:m:g:j:f:M:S:w:x:u:b:rvh")) != (wchar_t)-1)
     {
         switch (opt)
         {
         case L'0':
-            input0path = optarg;
+            job.input0path = optarg;
             break;
         case L'1':
-            input1path = optarg;
+            job.input1path = optarg;
             break;
         case L'i':
-            inputpath = optarg;
+            job.inputpath = optarg;
             break;
         case L'o':
-            outputpath = optarg;
+            job.outputpath = optarg;
             break;
         case L'n':
-            numframe = _wtoi(optarg);
+            job.numframe = _wtoi(optarg);
             break;
         case L's':
-            timestep = _wtof(optarg);
+            job.timestep = _wtof(optarg);
             break;
         case L't':
             tilesize = parse_optarg_int_array(optarg);
@@ -490,14 +3280,38 @@ int main(int argc, char** argv)
             gpuid = parse_optarg_int_array(optarg);
             break;
         case L'j':
-            swscanf(optarg, L"%d:%*[^:]:%d", &jobs_load, &jobs_save);
+            swscanf(optarg, L"%d:%*[^:]:%d", &job.jobs_load, &job.jobs_save);
             jobs_proc = parse_optarg_int_array(wcschr(optarg, L':') + 1);
             break;
         case L'f':
-            pattern_format = optarg;
+            job.pattern_format = optarg;
+            break;
+        case L'M':
+            max_host_mem = parse_optarg_size(optarg);
+            break;
+        case L'S':
+            swscanf(optarg, L"%d/%d", &job.shard_index, &job.shard_count);
+            break;
+        case L'w':
+            jobdir = optarg;
+            break;
+        case L'x':
+            job.scene_threshold = _wtof(optarg);
+            break;
+        case L'u':
+            job.dup_tolerance = _wtoi(optarg);
+            break;
+        case L'k':
+            job.static_tolerance = _wtoi(optarg);
+            break;
+        case L'b':
+            job.border_level = _wtoi(optarg);
+            break;
+        case L'r':
+            job.resume = 1;
             break;
         case L'v':
-            verbose = 1;
+            job.verbose = 1;
             break;
         case L'h':
         default:
@@ -507,27 +3321,27 @@ int main(int argc, char** argv)
     }
 #else // _WIN32
     int opt;
-    while ((opt = getopt(argc, argv, "0:1:i:o:n:s:t:m:g:j:f:vh")) != -1)
+    while ((opt = getopt(argc, argv, "0:1:i:o:n:s:t:k:m:g:j:f:M:S:w:x:u:b:d:c:rvh")) != -1)
     {
         switch (opt)
         {
         case '0':
-            input0path = optarg;
+            job.input0path = optarg;
             break;
         case '1':
-            input1path = optarg;
+            job.input1path = optarg;
             break;
         case 'i':
-            inputpath = optarg;
+            job.inputpath = optarg;
             break;
         case 'o':
-            outputpath = optarg;
+            job.outputpath = optarg;
             break;
         case 'n':
-            numframe = atoi(optarg);
+            job.numframe = atoi(optarg);
             break;
         case 's':
-            timestep = atof(optarg);
+            job.timestep = atof(optarg);
             break;
         case 't':
             tilesize = parse_optarg_int_array(optarg);
@@ -539,14 +3353,44 @@ int main(int argc, char** argv)
             gpuid = parse_optarg_int_array(optarg);
             break;
         case 'j':
-            sscanf(optarg, "%d:%*[^:]:%d", &jobs_load, &jobs_save);
+            sscanf(optarg, "%d:%*[^:]:%d", &job.jobs_load, &job.jobs_save);
             jobs_proc = parse_optarg_int_array(strchr(optarg, ':') + 1);
             break;
         case 'f':
-            pattern_format = optarg;
+            job.pattern_format = optarg;
+            break;
+        case 'M':
+            max_host_mem = parse_optarg_size(optarg);
+            break;
+        case 'S':
+            sscanf(optarg, "%d/%d", &job.shard_index, &job.shard_count);
+            break;
+        case 'w':
+            jobdir = optarg;
+            break;
+        case 'x':
+            job.scene_threshold = atof(optarg);
+            break;
+        case 'u':
+            job.dup_tolerance = atoi(optarg);
+            break;
+        case 'k':
+            job.static_tolerance = atoi(optarg);
+            break;
+        case 'b':
+            job.border_level = atoi(optarg);
+            break;
+        case 'd':
+            serverpath = optarg;
+            break;
+        case 'c':
+            clientpath = optarg;
+            break;
+        case 'r':
+            job.resume = 1;
             break;
         case 'v':
-            verbose = 1;
+            job.verbose = 1;
             break;
         case 'h':
         default:
@@ -556,23 +3400,36 @@ int main(int argc, char** argv)
     }
 #endif // _WIN32
 
-    if (((input0path.empty() || input1path.empty()) && inputpath.empty()) || outputpath.empty())
+#if !_WIN32
+    const bool server = !serverpath.empty();
+#else
+    const bool server = false;
+#endif
+
+    if (!server && (((job.input0path.empty() || job.input1path.empty()) && job.inputpath.empty()) || job.outputpath.empty()))
     {
         print_usage();
         return -1;
     }
 
-    if (inputpath.empty() && (timestep <= 0.f || timestep >= 1.f))
+    if (!jobdir.empty() && (server || job.shard_count > 1))
     {
-        fprintf(stderr, "invalid timestep argument, must be 0~1\n");
+        fprintf(stderr, "work queue runs the whole job without shard or server\n");
         return -1;
     }
 
-    if (!inputpath.empty() && numframe < 0)
+#if !_WIN32
+    if (!clientpath.empty())
     {
-        fprintf(stderr, "invalid numframe argument, must not be negative\n");
-        return -1;
+        if (!jobdir.empty())
+        {
+            fprintf(stderr, "work queue runs locally, not through a server\n");
+            return -1;
+        }
+
+        return submit_job(clientpath.c_str(), job);
     }
+#endif
 
     if (tilesize.size() != (gpuid.empty() ? 1 : gpuid.size()) && !tilesize.empty())
     {
@@ -589,12 +3446,6 @@ int main(int argc, char** argv)
         }
     }
 
-    if (jobs_load < 1 || jobs_save < 1)
-    {
-        fprintf(stderr, "invalid thread count argument\n");
-        return -1;
-    }
-
     if (jobs_proc.size() != (gpuid.empty() ? 1 : gpuid.size()) && !jobs_proc.empty())
     {
         fprintf(stderr, "invalid jobs_proc thread count argument\n");
@@ -610,138 +3461,64 @@ int main(int argc, char** argv)
         }
     }
 
-    path_t pattern = get_file_name_without_extension(pattern_format);
-    path_t format = get_file_extension(pattern_format);
-
-    if (format.empty())
+    if (model.find(PATHSTR("best")) != path_t::npos)
     {
-        pattern = PATHSTR("%08d");
-        format = pattern_format;
+        // fine
     }
-
-    if (pattern.empty())
+    else
     {
-        pattern = PATHSTR("%08d");
+        fprintf(stderr, "unknown model dir type\n");
+        return -1;
     }
 
-    if (!path_is_directory(outputpath))
-    {
-        // guess format from outputpath no matter what format argument specified
-        path_t ext = get_file_extension(outputpath);
+    path_t modeldir = sanitize_dirpath(model);
 
-        if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
-        {
-            format = PATHSTR("png");
-        }
-        else if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
-        {
-            format = PATHSTR("webp");
-        }
-        else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
-        {
-            format = PATHSTR("jpg");
-        }
-        else
-        {
-            fprintf(stderr, "invalid outputpath extension type\n");
-            return -1;
-        }
+    if (max_host_mem > 0)
+    {
+        // queue depth follows the frame size, the budget does the throttling
+        host_memory_budget.budget = max_host_mem;
+        toproc.max_length = 0;
     }
 
-    if (format != PATHSTR("png") && format != PATHSTR("webp") && format != PATHSTR("jpg"))
-    {
-        fprintf(stderr, "invalid format argument\n");
+    Session session;
+    if (!server && setup_session(job, session) != 0)
         return -1;
-    }
 
-    // collect input and output filepath
-    std::vector<path_t> input0_files;
-    std::vector<path_t> input1_files;
-    std::vector<path_t> output_files;
-    std::vector<float> timesteps;
+    // chunks are contiguous ranges of output frames, the same in every worker of the job
+    int chunk_count = 0;
+    if (!jobdir.empty())
     {
-        if (!inputpath.empty() && path_is_directory(inputpath) && path_is_directory(outputpath))
-        {
-            std::vector<path_t> filenames;
-            int lr = list_directory(inputpath, filenames);
-            if (lr != 0)
-                return -1;
-
-            const int count = filenames.size();
-            if (numframe == 0)
-                numframe = count * 2;
-
-            input0_files.resize(numframe);
-            input1_files.resize(numframe);
-            output_files.resize(numframe);
-            timesteps.resize(numframe);
-
-            double scale = (double)count / numframe;
-            for (int i=0; i<numframe; i++)
-            {
-                // TODO provide option to control timestep interpolate method
-//                 float fx = (float)((i + 0.5) * scale - 0.5);
-                float fx = i * scale;
-                int sx = static_cast<int>(floor(fx));
-                fx -= sx;
-
-                if (sx < 0)
-                {
-                    sx = 0;
-                    fx = 0.f;
-                }
-                if (sx >= count - 1)
-                {
-                    sx = count - 2;
-                    fx = 1.f;
-                }
-
-//                 fprintf(stderr, "%d %f %d\n", i, fx, sx);
-
-                path_t filename0 = filenames[sx];
-                path_t filename1 = filenames[sx + 1];
-
-#if _WIN32
-                wchar_t tmp[256];
-                swprintf(tmp, pattern.c_str(), i+1);
-#else
-                char tmp[256];
-                sprintf(tmp, pattern.c_str(), i+1); // ffmpeg start from 1
-#endif
-                path_t output_filename = path_t(tmp) + PATHSTR('.') + format;
-
-                input0_files[i] = inputpath + PATHSTR('/') + filename0;
-                input1_files[i] = inputpath + PATHSTR('/') + filename1;
-                output_files[i] = outputpath + PATHSTR('/') + output_filename;
-                timesteps[i] = fx;
-            }
-        }
-        else if (inputpath.empty() && !path_is_directory(input0path) && !path_is_directory(input1path) && !path_is_directory(outputpath))
+        if (session.planner.inputpath.empty() || session.archive_output)
         {
-            input0_files.push_back(input0path);
-            input1_files.push_back(input1path);
-            output_files.push_back(outputpath);
-            timesteps.push_back(timestep);
+            fprintf(stderr, "work queue needs input-path and directory output\n");
+            return -1;
         }
-        else
+
+        if (session.video_input)
         {
-            fprintf(stderr, "input0path, input1path and outputpath must be file at the same time\n");
-            fprintf(stderr, "inputpath and outputpath must be directory at the same time\n");
+            // every chunk would decode the video from its start
+            fprintf(stderr, "work queue needs an image directory input, not a video\n");
             return -1;
         }
-    }
 
-    if (model.find(PATHSTR("best")) != path_t::npos)
-    {
-        // fine
+        chunk_count = std::max(1, (session.planner.numframe + WORK_CHUNK_FRAMES - 1) / WORK_CHUNK_FRAMES);
     }
-    else
+
+#if !_WIN32
+    // the png level is process wide, in server mode it follows the -f option of the server
+    EncodeOptions png_options = session.encode_options;
+    if (server)
     {
-        fprintf(stderr, "unknown model dir type\n");
-        return -1;
+        size_t colon = job.pattern_format.find(':');
+        if (colon != path_t::npos && parse_format_options(PATHSTR("png"), job.pattern_format.substr(colon + 1), png_options) != 0)
+            png_options = EncodeOptions();
     }
 
-    path_t modeldir = sanitize_dirpath(model);
+    // level 0 also skips the per-row filter search, the filter is process wide
+    // so in server mode it follows the level of the server, not of the job
+    stbi_write_png_compression_level = png_options.png_level;
+    stbi_write_force_png_filter = png_options.png_level == 0 ? 0 : -1;
+#endif
 
 #if _WIN32
     CoInitializeEx(NULL, COINIT_MULTITHREADED);
@@ -766,10 +3543,6 @@ int main(int argc, char** argv)
         tilesize.resize(use_gpu_count, 256);
     }
 
-    int cpu_count = std::max(1, ncnn::get_cpu_count());
-    jobs_load = std::min(jobs_load, cpu_count);
-    jobs_save = std::min(jobs_save, cpu_count);
-
     int gpu_count = ncnn::get_gpu_count();
     for (int i=0; i<use_gpu_count; i++)
     {
@@ -790,6 +3563,8 @@ int main(int argc, char** argv)
         total_jobs_proc += jobs_proc[i];
     }
 
+    int ret = 0;
+
     {
         std::vector<DAIN*> dain(use_gpu_count);
 
@@ -804,23 +3579,16 @@ int main(int argc, char** argv)
 
         // main routine
         {
-            // load image
-            LoadThreadParams ltp;
-            ltp.jobs_load = jobs_load;
-            ltp.input0_files = input0_files;
-            ltp.input1_files = input1_files;
-            ltp.output_files = output_files;
-            ltp.timesteps = timesteps;
-
-            ncnn::Thread load_thread(load, (void*)&ltp);
-
-            // dain proc
+            // dain proc, shared by every session
             std::vector<ProcThreadParams> ptp(use_gpu_count);
             for (int i=0; i<use_gpu_count; i++)
             {
-                ptp[i].dain = dain[i];
+                ptp[i].dain = &dain;
+                ptp[i].device = i;
             }
 
+            toproc.init(gpuid, jobs_proc);
+
             std::vector<ncnn::Thread*> proc_threads(total_jobs_proc);
             {
                 int total_jobs_proc_id = 0;
@@ -833,42 +3601,35 @@ int main(int argc, char** argv)
                 }
             }
 
-            // save image
-            SaveThreadParams stp;
-            stp.verbose = verbose;
-
-            std::vector<ncnn::Thread*> save_threads(jobs_save);
-            for (int i=0; i<jobs_save; i++)
+#if !_WIN32
+            if (server)
             {
-                save_threads[i] = new ncnn::Thread(save, (void*)&stp);
+                // models stay loaded for every job that follows
+                ret = serve(serverpath.c_str());
             }
-
-            // end
-            load_thread.join();
-
-            Task end;
-            end.id = -233;
-
-            for (int i=0; i<total_jobs_proc; i++)
+            else
+#endif
+            if (!jobdir.empty())
+            {
+                ret = run_work_queue(jobdir, session, chunk_count);
+            }
+            else
             {
-                toproc.put(end);
+                ret = run_session(session);
             }
 
+            // end
+            toproc.finish();
+
             for (int i=0; i<total_jobs_proc; i++)
             {
                 proc_threads[i]->join();
                 delete proc_threads[i];
             }
 
-            for (int i=0; i<jobs_save; i++)
+            if (job.verbose)
             {
-                tosave.put(end);
-            }
-
-            for (int i=0; i<jobs_save; i++)
-            {
-                save_threads[i]->join();
-                delete save_threads[i];
+                toproc.print_utilization();
             }
         }
 
@@ -881,5 +3642,5 @@ int main(int argc, char** argv)
 
     ncnn::destroy_gpu_instance();
 
-    return 0;
+    return ret;
 }
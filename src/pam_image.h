@@ -0,0 +1,278 @@
+#ifndef PAM_IMAGE_H
+#define PAM_IMAGE_H
+
+// uncompressed pam (P7) and ppm (P6) image decoder and encoder
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+#if _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include "frame_pool.h"
+
+static int pam_read_token(const unsigned char*& p, const unsigned char* end, char* token, int maxlen)
+{
+    // skip whitespace and comments
+    while (p < end)
+    {
+        if (*p == '#')
+        {
+            while (p < end && *p != '\n')
+                p++;
+        }
+        else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        {
+            p++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    int len = 0;
+    while (p < end && len < maxlen - 1 && !(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        token[len++] = *p++;
+    }
+    token[len] = '\0';
+
+    return len;
+}
+
+// 8-bit rgb or rgb_alpha only, always decodes to 3 channels
+unsigned char* pam_load(const unsigned char* buffer, int len, int* w, int* h, int* c)
+{
+    if (len < 3 || buffer[0] != 'P' || (buffer[1] != '6' && buffer[1] != '7'))
+        return NULL;
+
+    const unsigned char* p = buffer + 2;
+    const unsigned char* end = buffer + len;
+
+    int width = 0;
+    int height = 0;
+    int depth = 3;
+    int maxval = 0;
+
+    char token[32];
+
+    if (buffer[1] == '6')
+    {
+        pam_read_token(p, end, token, sizeof(token));
+        width = atoi(token);
+        pam_read_token(p, end, token, sizeof(token));
+        height = atoi(token);
+        pam_read_token(p, end, token, sizeof(token));
+        maxval = atoi(token);
+    }
+    else
+    {
+        while (pam_read_token(p, end, token, sizeof(token)) > 0)
+        {
+            if (strcmp(token, "ENDHDR") == 0)
+                break;
+
+            if (strcmp(token, "TUPLTYPE") == 0)
+            {
+                pam_read_token(p, end, token, sizeof(token));
+                continue;
+            }
+
+            char value[32];
+            pam_read_token(p, end, value, sizeof(value));
+
+            if (strcmp(token, "WIDTH") == 0)
+                width = atoi(value);
+            else if (strcmp(token, "HEIGHT") == 0)
+                height = atoi(value);
+            else if (strcmp(token, "DEPTH") == 0)
+                depth = atoi(value);
+            else if (strcmp(token, "MAXVAL") == 0)
+                maxval = atoi(value);
+        }
+    }
+
+    // single whitespace before the raster
+    p++;
+
+    if (width <= 0 || height <= 0 || maxval != 255 || (depth != 3 && depth != 4))
+        return NULL;
+
+    if (end - p < (ptrdiff_t)width * height * depth)
+        return NULL;
+
+    unsigned char* pixeldata = (unsigned char*)frame_pool_malloc((size_t)width * height * 3);
+    if (!pixeldata)
+        return NULL;
+
+#if !_WIN32
+    if (depth == 3)
+    {
+        memcpy(pixeldata, p, (size_t)width * height * 3);
+    }
+    else
+#endif
+    {
+        const size_t pixel_count = (size_t)width * height;
+        for (size_t i = 0; i < pixel_count; i++)
+        {
+#if _WIN32
+            pixeldata[i * 3 + 0] = p[i * depth + 2];
+            pixeldata[i * 3 + 1] = p[i * depth + 1];
+            pixeldata[i * 3 + 2] = p[i * depth + 0];
+#else
+            pixeldata[i * 3 + 0] = p[i * depth + 0];
+            pixeldata[i * 3 + 1] = p[i * depth + 1];
+            pixeldata[i * 3 + 2] = p[i * depth + 2];
+#endif
+        }
+    }
+
+    *w = width;
+    *h = height;
+    *c = 3;
+
+    return pixeldata;
+}
+
+static int pam_write_header(char* header, int w, int h, int c, int ppm)
+{
+    if (ppm)
+        return sprintf(header, "P6\n%d %d\n255\n", w, h);
+
+    return sprintf(header, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", w, h, c, c == 4 ? "RGB_ALPHA" : "RGB");
+}
+
+// in memory, for outputs that are not written as separate files
+int pam_encode(int w, int h, int c, const unsigned char* pixeldata, int ppm, std::vector<unsigned char>& filedata)
+{
+    if (c != 3 && c != 4)
+        return 0;
+
+    if (ppm && c != 3)
+        return 0;
+
+    char header[128];
+    const int header_len = pam_write_header(header, w, h, c, ppm);
+
+    const size_t size = (size_t)w * h * c;
+
+    filedata.resize(header_len + size);
+    memcpy(filedata.data(), header, header_len);
+
+    unsigned char* p = filedata.data() + header_len;
+#if _WIN32
+    for (size_t i = 0; i < size; i += c)
+    {
+        p[i + 0] = pixeldata[i + 2];
+        p[i + 1] = pixeldata[i + 1];
+        p[i + 2] = pixeldata[i + 0];
+        if (c == 4)
+            p[i + 3] = pixeldata[i + 3];
+    }
+#else
+    memcpy(p, pixeldata, size);
+#endif
+
+    return 1;
+}
+
+// header and pixels go out in one writev, the pixels are never copied
+#if _WIN32
+int pam_save(const wchar_t* filepath, int w, int h, int c, const unsigned char* pixeldata, int ppm)
+#else
+int pam_save(const char* filepath, int w, int h, int c, const unsigned char* pixeldata, int ppm)
+#endif
+{
+    if (c != 3 && c != 4)
+        return 0;
+
+    if (ppm && c != 3)
+        return 0;
+
+    char header[128];
+    const int header_len = pam_write_header(header, w, h, c, ppm);
+
+    const size_t size = (size_t)w * h * c;
+
+#if _WIN32
+    // wic and webp decode to bgr
+    std::vector<unsigned char> rgbdata(size);
+    for (size_t i = 0; i < size; i += c)
+    {
+        rgbdata[i + 0] = pixeldata[i + 2];
+        rgbdata[i + 1] = pixeldata[i + 1];
+        rgbdata[i + 2] = pixeldata[i + 0];
+        if (c == 4)
+            rgbdata[i + 3] = pixeldata[i + 3];
+    }
+
+    FILE* fp = _wfopen(filepath, L"wb");
+    if (!fp)
+        return 0;
+
+    int ret = fwrite(header, 1, header_len, fp) == (size_t)header_len && fwrite(rgbdata.data(), 1, size, fp) == size;
+
+    // on disk before the caller renames it into place
+    if (ret && (fflush(fp) != 0 || _commit(_fileno(fp)) != 0))
+        ret = 0;
+
+    fclose(fp);
+
+    return ret;
+#else
+    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = header_len;
+    iov[1].iov_base = (void*)pixeldata;
+    iov[1].iov_len = size;
+
+    size_t total = header_len + size;
+    size_t written = 0;
+    int ret = 1;
+    while (written < total)
+    {
+        ssize_t n = writev(fd, iov, 2);
+        if (n <= 0)
+        {
+            ret = 0;
+            break;
+        }
+
+        written += n;
+
+        // resume a short write
+        size_t skip = n;
+        for (int i = 0; i < 2; i++)
+        {
+            size_t s = std::min(skip, iov[i].iov_len);
+            iov[i].iov_base = (unsigned char*)iov[i].iov_base + s;
+            iov[i].iov_len -= s;
+            skip -= s;
+        }
+    }
+
+    // on disk before the caller renames it into place
+    if (ret && fsync(fd) != 0)
+        ret = 0;
+
+    close(fd);
+
+    return ret;
+#endif
+}
+
+#endif // PAM_IMAGE_H
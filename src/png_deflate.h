@@ -0,0 +1,105 @@
+#ifndef PNG_DEFLATE_H
+#define PNG_DEFLATE_H
+
+// zlib stream compressor for stb_image_write png output, plugged in with STBIW_ZLIB_COMPRESS
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "libdeflate.h"
+
+// level 0, raw rows wrapped in stored deflate blocks
+static unsigned char* png_zlib_stored(const unsigned char* data, int data_len, int* out_len)
+{
+    const int block_count = data_len / 65535 + 1;
+
+    unsigned char* out = (unsigned char*)malloc(2 + block_count * 5 + data_len + 4);
+    if (!out)
+        return 0;
+
+    unsigned char* p = out;
+
+    // 32K window, fastest
+    *p++ = 0x78;
+    *p++ = 0x01;
+
+    unsigned int s1 = 1;
+    unsigned int s2 = 0;
+
+    for (int i = 0; i < block_count; i++)
+    {
+        const int offset = i * 65535;
+        const int len = std::min(data_len - offset, 65535);
+
+        *p++ = i == block_count - 1 ? 1 : 0;
+        *p++ = len & 0xff;
+        *p++ = (len >> 8) & 0xff;
+        *p++ = ~len & 0xff;
+        *p++ = (~len >> 8) & 0xff;
+
+        memcpy(p, data + offset, len);
+        p += len;
+
+        // adler32, the block is small enough for deferred modulo
+        for (int j = 0; j < len; j++)
+        {
+            s1 += data[offset + j];
+            s2 += s1;
+            if ((j & 4095) == 4095)
+            {
+                s1 %= 65521;
+                s2 %= 65521;
+            }
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+
+    const unsigned int adler = (s2 << 16) | s1;
+    *p++ = (adler >> 24) & 0xff;
+    *p++ = (adler >> 16) & 0xff;
+    *p++ = (adler >> 8) & 0xff;
+    *p++ = adler & 0xff;
+
+    *out_len = (int)(p - out);
+    return out;
+}
+
+// level of the png the calling thread writes, set before each stb_image_write call so that
+// concurrent sessions keep their own level, stb only passes its process wide level
+static thread_local int png_deflate_level = 8;
+
+unsigned char* png_zlib_compress(unsigned char* data, int data_len, int* out_len, int stb_level)
+{
+    (void)stb_level;
+    const int quality = png_deflate_level;
+
+    if (quality <= 0)
+        return png_zlib_stored(data, data_len, out_len);
+
+    // compressors are cheap compared to a frame and not thread-safe, one per call
+    struct libdeflate_compressor* compressor = libdeflate_alloc_compressor(std::min(quality, 12));
+    if (!compressor)
+        return 0;
+
+    const size_t bound = libdeflate_zlib_compress_bound(compressor, data_len);
+
+    unsigned char* out = (unsigned char*)malloc(bound);
+    size_t length = 0;
+    if (out)
+    {
+        length = libdeflate_zlib_compress(compressor, data, data_len, out, bound);
+    }
+
+    libdeflate_free_compressor(compressor);
+
+    if (length == 0)
+    {
+        free(out);
+        return 0;
+    }
+
+    *out_len = (int)length;
+    return out;
+}
+
+#endif // PNG_DEFLATE_H
@@ -0,0 +1,252 @@
+#ifndef QOI_IMAGE_H
+#define QOI_IMAGE_H
+
+// qoi image decoder and encoder, see https://qoiformat.org/qoi-specification.pdf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "frame_pool.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+static inline int qoi_hash(const unsigned char* px)
+{
+    return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+static inline unsigned int qoi_read_u32(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+// always decodes to 3 channels, alpha is dropped
+unsigned char* qoi_load(const unsigned char* buffer, int len, int* w, int* h, int* c)
+{
+    if (len < QOI_HEADER_SIZE + QOI_PADDING_SIZE || memcmp(buffer, "qoif", 4) != 0)
+        return NULL;
+
+    const unsigned int width = qoi_read_u32(buffer + 4);
+    const unsigned int height = qoi_read_u32(buffer + 8);
+    const int channels = buffer[12];
+
+    if (width == 0 || height == 0 || width > 65536 || height > 65536 || (channels != 3 && channels != 4))
+        return NULL;
+
+    unsigned char* pixeldata = (unsigned char*)frame_pool_malloc((size_t)width * height * 3);
+    if (!pixeldata)
+        return NULL;
+
+    unsigned char index[64 * 4];
+    memset(index, 0, sizeof(index));
+
+    unsigned char px[4] = {0, 0, 0, 255};
+
+    const unsigned char* p = buffer + QOI_HEADER_SIZE;
+    const unsigned char* chunks_end = buffer + len - QOI_PADDING_SIZE;
+
+    const size_t pixel_count = (size_t)width * height;
+    int run = 0;
+
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        if (run > 0)
+        {
+            run--;
+        }
+        else if (p < chunks_end)
+        {
+            const int b1 = *p++;
+
+            if (b1 == QOI_OP_RGB)
+            {
+                px[0] = p[0];
+                px[1] = p[1];
+                px[2] = p[2];
+                p += 3;
+            }
+            else if (b1 == QOI_OP_RGBA)
+            {
+                px[0] = p[0];
+                px[1] = p[1];
+                px[2] = p[2];
+                px[3] = p[3];
+                p += 4;
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+            {
+                memcpy(px, index + b1 * 4, 4);
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+            {
+                px[0] += ((b1 >> 4) & 0x03) - 2;
+                px[1] += ((b1 >> 2) & 0x03) - 2;
+                px[2] += (b1 & 0x03) - 2;
+            }
+            else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+            {
+                const int b2 = *p++;
+                const int vg = (b1 & 0x3f) - 32;
+                px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                px[1] += vg;
+                px[2] += vg - 8 + (b2 & 0x0f);
+            }
+            else
+            {
+                run = b1 & 0x3f;
+            }
+
+            memcpy(index + qoi_hash(px) * 4, px, 4);
+        }
+
+#if _WIN32
+        pixeldata[i * 3 + 0] = px[2];
+        pixeldata[i * 3 + 1] = px[1];
+        pixeldata[i * 3 + 2] = px[0];
+#else
+        pixeldata[i * 3 + 0] = px[0];
+        pixeldata[i * 3 + 1] = px[1];
+        pixeldata[i * 3 + 2] = px[2];
+#endif
+    }
+
+    *w = width;
+    *h = height;
+    *c = 3;
+
+    return pixeldata;
+}
+
+int qoi_save(int w, int h, int c, const unsigned char* pixeldata, std::vector<unsigned char>& filedata)
+{
+    if (c != 3 && c != 4)
+        return 0;
+
+    // worst case every pixel becomes QOI_OP_RGBA
+    filedata.resize(QOI_HEADER_SIZE + (size_t)w * h * (c + 1) + QOI_PADDING_SIZE);
+
+    unsigned char* p = filedata.data();
+
+    memcpy(p, "qoif", 4);
+    p[4] = (w >> 24) & 0xff;
+    p[5] = (w >> 16) & 0xff;
+    p[6] = (w >> 8) & 0xff;
+    p[7] = w & 0xff;
+    p[8] = (h >> 24) & 0xff;
+    p[9] = (h >> 16) & 0xff;
+    p[10] = (h >> 8) & 0xff;
+    p[11] = h & 0xff;
+    p[12] = c;
+    p[13] = 0; // sRGB with linear alpha
+    p += QOI_HEADER_SIZE;
+
+    unsigned char index[64 * 4];
+    memset(index, 0, sizeof(index));
+
+    unsigned char px_prev[4] = {0, 0, 0, 255};
+    unsigned char px[4] = {0, 0, 0, 255};
+
+    const size_t pixel_count = (size_t)w * h;
+    int run = 0;
+
+    for (size_t i = 0; i < pixel_count; i++)
+    {
+        const unsigned char* ptr = pixeldata + i * c;
+#if _WIN32
+        px[0] = ptr[2];
+        px[1] = ptr[1];
+        px[2] = ptr[0];
+#else
+        px[0] = ptr[0];
+        px[1] = ptr[1];
+        px[2] = ptr[2];
+#endif
+        if (c == 4)
+            px[3] = ptr[3];
+
+        if (memcmp(px, px_prev, 4) == 0)
+        {
+            run++;
+            if (run == 62 || i == pixel_count - 1)
+            {
+                *p++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0)
+        {
+            *p++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        const int index_pos = qoi_hash(px);
+
+        if (memcmp(index + index_pos * 4, px, 4) == 0)
+        {
+            *p++ = QOI_OP_INDEX | index_pos;
+        }
+        else
+        {
+            memcpy(index + index_pos * 4, px, 4);
+
+            if (px[3] == px_prev[3])
+            {
+                const signed char vr = px[0] - px_prev[0];
+                const signed char vg = px[1] - px_prev[1];
+                const signed char vb = px[2] - px_prev[2];
+
+                const signed char vg_r = vr - vg;
+                const signed char vg_b = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                {
+                    *p++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                }
+                else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+                {
+                    *p++ = QOI_OP_LUMA | (vg + 32);
+                    *p++ = (vg_r + 8) << 4 | (vg_b + 8);
+                }
+                else
+                {
+                    *p++ = QOI_OP_RGB;
+                    *p++ = px[0];
+                    *p++ = px[1];
+                    *p++ = px[2];
+                }
+            }
+            else
+            {
+                *p++ = QOI_OP_RGBA;
+                *p++ = px[0];
+                *p++ = px[1];
+                *p++ = px[2];
+                *p++ = px[3];
+            }
+        }
+
+        memcpy(px_prev, px, 4);
+    }
+
+    // end marker
+    memset(p, 0, QOI_PADDING_SIZE - 1);
+    p[QOI_PADDING_SIZE - 1] = 1;
+    p += QOI_PADDING_SIZE;
+
+    filedata.resize(p - filedata.data());
+
+    return 1;
+}
+
+#endif // QOI_IMAGE_H
@@ -0,0 +1,69 @@
+#ifndef SCENE_CUT_H
+#define SCENE_CUT_H
+
+// hard cut detection between two source frames with downsampled luma histograms
+#include <math.h>
+#include <string.h>
+
+// ncnn
+#include "mat.h"
+
+#define SCENE_CUT_BINS 64
+
+// every SCENE_CUT_STEP-th pixel of every SCENE_CUT_STEP-th row is sampled
+#define SCENE_CUT_STEP 4
+
+static void scene_histogram(const ncnn::Mat& image, float* hist)
+{
+    memset(hist, 0, SCENE_CUT_BINS * sizeof(float));
+
+    const int w = image.w;
+    const int h = image.h;
+    const int c = image.elempack;
+
+    int samples = 0;
+    for (int y = 0; y < h; y += SCENE_CUT_STEP)
+    {
+        const unsigned char* row = (const unsigned char*)image.data + (size_t)y * w * c;
+        for (int x = 0; x < w; x += SCENE_CUT_STEP)
+        {
+            const unsigned char* px = row + x * c;
+#if _WIN32
+            const int luma = (px[2] * 77 + px[1] * 150 + px[0] * 29) >> 8;
+#else
+            const int luma = (px[0] * 77 + px[1] * 150 + px[2] * 29) >> 8;
+#endif
+            hist[luma * SCENE_CUT_BINS / 256] += 1.f;
+            samples++;
+        }
+    }
+
+    for (int i = 0; i < SCENE_CUT_BINS; i++)
+    {
+        hist[i] /= samples;
+    }
+}
+
+// 0 = same luma distribution, 1 = no luma level in common
+static float scene_difference(const float* hist0, const float* hist1)
+{
+    float diff = 0.f;
+    for (int i = 0; i < SCENE_CUT_BINS; i++)
+    {
+        diff += fabsf(hist0[i] - hist1[i]);
+    }
+
+    return diff * 0.5f;
+}
+
+static float scene_difference(const ncnn::Mat& image0, const ncnn::Mat& image1)
+{
+    float hist0[SCENE_CUT_BINS];
+    float hist1[SCENE_CUT_BINS];
+    scene_histogram(image0, hist0);
+    scene_histogram(image1, hist1);
+
+    return scene_difference(hist0, hist1);
+}
+
+#endif // SCENE_CUT_H
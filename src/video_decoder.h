@@ -0,0 +1,238 @@
+#ifndef VIDEO_DECODER_H
+#define VIDEO_DECODER_H
+
+// video container decoder with libavformat libavcodec and libswscale
+#include <stdio.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+// ncnn
+#include "mat.h"
+
+#include "filesystem_utils.h"
+
+class VideoDecoder
+{
+public:
+    VideoDecoder()
+    {
+        fmt_ctx = 0;
+        codec_ctx = 0;
+        stream_index = -1;
+        packet = 0;
+        frame = 0;
+        sws = 0;
+        nb_frames = 0;
+        draining = false;
+        log = stderr;
+    }
+
+    ~VideoDecoder()
+    {
+        close();
+    }
+
+    // thread_count decoder threads, 0 = one per cpu, frame and slice threading as the codec supports
+    int open(const path_t& path, int thread_count)
+    {
+        std::string url = path_to_utf8(path);
+
+        if (avformat_open_input(&fmt_ctx, url.c_str(), NULL, NULL) < 0 || avformat_find_stream_info(fmt_ctx, NULL) < 0)
+        {
+            fprintf(log, "open video %s failed\n", url.c_str());
+            close();
+            return -1;
+        }
+
+        stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+        if (stream_index < 0)
+        {
+            fprintf(log, "no video stream in %s\n", url.c_str());
+            close();
+            return -1;
+        }
+
+        AVStream* stream = fmt_ctx->streams[stream_index];
+
+        const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+        codec_ctx = codec ? avcodec_alloc_context3(codec) : 0;
+        if (!codec_ctx || avcodec_parameters_to_context(codec_ctx, stream->codecpar) < 0)
+        {
+            fprintf(log, "unsupported video codec in %s\n", url.c_str());
+            close();
+            return -1;
+        }
+
+        codec_ctx->thread_count = thread_count;
+        codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+        if (avcodec_open2(codec_ctx, codec, NULL) < 0)
+        {
+            fprintf(log, "open video decoder for %s failed\n", url.c_str());
+            close();
+            return -1;
+        }
+
+        nb_frames = stream->nb_frames > 0 ? (int)stream->nb_frames : count_packets(url);
+
+        packet = av_packet_alloc();
+        frame = av_frame_alloc();
+
+        return 0;
+    }
+
+    void close()
+    {
+        sws_freeContext(sws);
+        sws = 0;
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&fmt_ctx);
+        stream_index = -1;
+        draining = false;
+    }
+
+    int frame_count() const
+    {
+        return nb_frames;
+    }
+
+    double frame_rate() const
+    {
+        AVRational fps = fmt_ctx->streams[stream_index]->avg_frame_rate;
+        return fps.num > 0 && fps.den > 0 ? av_q2d(fps) : 25.0;
+    }
+
+    // decode the next frame into a 3 channel image from allocator, returns -1 at the end of stream
+    int read(ncnn::Mat& image, ncnn::Allocator* allocator, double* timestamp)
+    {
+        if (decode() != 0)
+            return -1;
+
+        const int w = frame->width;
+        const int h = frame->height;
+
+#if _WIN32
+        const AVPixelFormat pixel_format = AV_PIX_FMT_BGR24;
+#else
+        const AVPixelFormat pixel_format = AV_PIX_FMT_RGB24;
+#endif
+
+        sws = sws_getCachedContext(sws, w, h, (AVPixelFormat)frame->format, w, h, pixel_format, SWS_BICUBIC, NULL, NULL, NULL);
+        if (!sws)
+        {
+            av_frame_unref(frame);
+            return -1;
+        }
+
+        image.create(w, h, (size_t)3, 3, allocator);
+
+        uint8_t* dst[4] = {(uint8_t*)image.data, 0, 0, 0};
+        int dst_stride[4] = {w * 3, 0, 0, 0};
+        sws_scale(sws, frame->data, frame->linesize, 0, h, dst, dst_stride);
+
+        *timestamp = frame->best_effort_timestamp == AV_NOPTS_VALUE ? 0.0 : frame->best_effort_timestamp * av_q2d(fmt_ctx->streams[stream_index]->time_base);
+
+        av_frame_unref(frame);
+
+        return 0;
+    }
+
+    // decode the next frame without converting it, returns -1 at the end of stream
+    int skip()
+    {
+        if (decode() != 0)
+            return -1;
+
+        av_frame_unref(frame);
+
+        return 0;
+    }
+
+private:
+    int decode()
+    {
+        for (;;)
+        {
+            int ret = avcodec_receive_frame(codec_ctx, frame);
+            if (ret == 0)
+                return 0;
+
+            if (ret != AVERROR(EAGAIN) || draining)
+                return -1;
+
+            if (av_read_frame(fmt_ctx, packet) < 0)
+            {
+                // flush the frames buffered by frame threading
+                draining = true;
+                avcodec_send_packet(codec_ctx, NULL);
+                continue;
+            }
+
+            if (packet->stream_index == stream_index)
+            {
+                avcodec_send_packet(codec_ctx, packet);
+            }
+
+            av_packet_unref(packet);
+        }
+    }
+
+    // containers without a frame count in the header, demux once without decoding
+    int count_packets(const std::string& url) const
+    {
+        AVFormatContext* ctx = 0;
+        if (avformat_open_input(&ctx, url.c_str(), NULL, NULL) < 0)
+            return 0;
+
+        int count = 0;
+
+        AVPacket* pkt = av_packet_alloc();
+        while (av_read_frame(ctx, pkt) >= 0)
+        {
+            if (pkt->stream_index == stream_index)
+                count++;
+
+            av_packet_unref(pkt);
+        }
+        av_packet_free(&pkt);
+
+        avformat_close_input(&ctx);
+
+        return count;
+    }
+
+    static std::string path_to_utf8(const path_t& path)
+    {
+#if _WIN32
+        int len = WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, NULL, 0, NULL, NULL);
+        std::string url(len, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, &url[0], len, NULL, NULL);
+        url.resize(len - 1);
+        return url;
+#else
+        return path;
+#endif
+    }
+
+public:
+    // open errors
+    FILE* log;
+
+private:
+    AVFormatContext* fmt_ctx;
+    AVCodecContext* codec_ctx;
+    int stream_index;
+    AVPacket* packet;
+    AVFrame* frame;
+    SwsContext* sws;
+    int nb_frames;
+    bool draining;
+};
+
+#endif // VIDEO_DECODER_H
@@ -4,8 +4,14 @@
 // webp image decoder and encoder with libwebp
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <vector>
 #include "webp/decode.h"
 #include "webp/encode.h"
+#include "frame_pool.h"
+
+// ncnn
+#include "platform.h"
 
 unsigned char* webp_load(const unsigned char* buffer, int len, int* w, int* h, int* c)
 {
@@ -21,7 +27,7 @@ unsigned char* webp_load(const unsigned char* buffer, int len, int* w, int* h, i
     int height = config.input.height;
     int channels = config.input.has_alpha ? 4 : 3;
 
-    pixeldata = (unsigned char*)malloc(width * height * channels);
+    pixeldata = (unsigned char*)frame_pool_malloc(width * height * channels);
 
 #if _WIN32
     config.output.colorspace = channels == 4 ? MODE_BGRA : MODE_BGR;
@@ -36,7 +42,7 @@ unsigned char* webp_load(const unsigned char* buffer, int len, int* w, int* h, i
 
     if (WebPDecode(buffer, len, &config) != VP8_STATUS_OK)
     {
-        free(pixeldata);
+        frame_pool_free(pixeldata);
         return NULL;
     }
 
@@ -47,58 +53,236 @@ unsigned char* webp_load(const unsigned char* buffer, int len, int* w, int* h, i
     return pixeldata;
 }
 
-#if _WIN32
-int webp_save(const wchar_t* filepath, int w, int h, int c, const unsigned char* pixeldata)
-#else
-int webp_save(const char* filepath, int w, int h, int c, const unsigned char* pixeldata)
-#endif
+// webp files from this size on are decoded while they are read, smaller ones are read at once
+#define WEBP_STREAM_MIN_SIZE (512 * 1024)
+#define WEBP_STREAM_CHUNK_SIZE (128 * 1024)
+
+// one buffer of the file size, filled by the reader thread while the decoder consumes the bytes arrived so far
+class WebPStream
 {
-    int ret = 0;
+public:
+    FILE* fp;
+    unsigned char* buffer;
+    size_t size;
 
-    unsigned char* output = 0;
-    size_t length = 0;
+    // written by the reader under lock
+    size_t filled;
+    bool done;
 
-    FILE* fp = 0;
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+};
 
-    if (c == 3)
+static void* webp_stream_read(void* args)
+{
+    WebPStream* stream = (WebPStream*)args;
+
+    size_t filled = 0;
+    while (filled < stream->size)
     {
-#if _WIN32
-        length = WebPEncodeLosslessBGR(pixeldata, w, h, w * 3, &output);
-#else
-        length = WebPEncodeLosslessRGB(pixeldata, w, h, w * 3, &output);
-#endif
+        const size_t n = fread(stream->buffer + filled, 1, std::min(stream->size - filled, (size_t)WEBP_STREAM_CHUNK_SIZE), stream->fp);
+        if (n == 0)
+            break;
+
+        filled += n;
+
+        stream->lock.lock();
+        stream->filled = filled;
+        stream->lock.unlock();
+
+        stream->condition.signal();
+    }
+
+    stream->lock.lock();
+    stream->done = true;
+    stream->lock.unlock();
+
+    stream->condition.signal();
+
+    return 0;
+}
+
+// bytes filled beyond have, 0 once the reader is done without more
+static size_t webp_stream_wait(WebPStream* stream, size_t have)
+{
+    stream->lock.lock();
+
+    while (stream->filled == have && !stream->done)
+    {
+        stream->condition.wait(stream->lock);
     }
-    else if (c == 4)
+
+    const size_t filled = stream->filled;
+
+    stream->lock.unlock();
+
+    return filled;
+}
+
+// decodes size bytes of fp while a reader thread reads them, WebPIUpdate decodes in place from the growing buffer
+unsigned char* webp_load_stream(FILE* fp, size_t size, int* w, int* h, int* c)
+{
+    WebPStream stream;
+    stream.fp = fp;
+    stream.buffer = (unsigned char*)malloc(size);
+    stream.size = size;
+    stream.filled = 0;
+    stream.done = false;
+
+    if (!stream.buffer)
+        return NULL;
+
+    // reads go straight into the buffer
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    ncnn::Thread reader(webp_stream_read, (void*)&stream);
+
+    unsigned char* pixeldata = 0;
+    WebPIDecoder* idec = 0;
+
+    WebPDecoderConfig config;
+    WebPInitDecoderConfig(&config);
+
+    // the header arrives with the first chunk
+    size_t filled = 0;
+    VP8StatusCode status = VP8_STATUS_NOT_ENOUGH_DATA;
+    while (status == VP8_STATUS_NOT_ENOUGH_DATA)
+    {
+        const size_t n = webp_stream_wait(&stream, filled);
+        if (n == filled)
+            break;
+
+        filled = n;
+        status = WebPGetFeatures(stream.buffer, filled, &config.input);
+    }
+
+    int width = config.input.width;
+    int height = config.input.height;
+    int channels = config.input.has_alpha ? 4 : 3;
+
+    if (status == VP8_STATUS_OK)
     {
+        pixeldata = (unsigned char*)frame_pool_malloc(width * height * channels);
+
 #if _WIN32
-        length = WebPEncodeLosslessBGRA(pixeldata, w, h, w * 4, &output);
+        config.output.colorspace = channels == 4 ? MODE_BGRA : MODE_BGR;
 #else
-        length = WebPEncodeLosslessRGBA(pixeldata, w, h, w * 4, &output);
+        config.output.colorspace = channels == 4 ? MODE_RGBA : MODE_RGB;
 #endif
+
+        config.output.u.RGBA.stride = width * channels;
+        config.output.u.RGBA.size = width * height * channels;
+        config.output.u.RGBA.rgba = pixeldata;
+        config.output.is_external_memory = 1;
+
+        idec = WebPINewDecoder(&config.output);
+        status = idec ? VP8_STATUS_SUSPENDED : VP8_STATUS_OUT_OF_MEMORY;
     }
-    else
+
+    size_t decoded = 0;
+    while (status == VP8_STATUS_SUSPENDED)
+    {
+        if (decoded == filled)
+        {
+            const size_t n = webp_stream_wait(&stream, filled);
+            if (n == filled)
+                break;
+
+            filled = n;
+        }
+
+        status = WebPIUpdate(idec, stream.buffer, filled);
+        decoded = filled;
+    }
+
+    // the reader owns fp until it returns
+    reader.join();
+
+    if (idec)
+        WebPIDelete(idec);
+
+    free(stream.buffer);
+
+    if (status != VP8_STATUS_OK)
+    {
+        frame_pool_free(pixeldata);
+        return NULL;
+    }
+
+    *w = width;
+    *h = height;
+    *c = channels;
+
+    return pixeldata;
+}
+
+static int webp_write_to_vector(const uint8_t* data, size_t data_size, const WebPPicture* picture)
+{
+    std::vector<unsigned char>* filedata = (std::vector<unsigned char>*)picture->custom_ptr;
+    filedata->insert(filedata->end(), data, data + data_size);
+    return 1;
+}
+
+// quality is the effort in lossless mode, method 0=fast~6=slower-better, thread_level 1 enables multi-threaded encoding
+int webp_save(int w, int h, int c, const unsigned char* pixeldata, int lossless, float quality, int method, int thread_level, std::vector<unsigned char>& filedata)
+{
+    if (c != 3 && c != 4)
     {
         // unsupported channel type
+        return 0;
     }
 
-    if (length == 0)
-        goto RETURN;
+    WebPConfig config;
+    if (!WebPConfigInit(&config))
+        return 0;
+
+    config.lossless = lossless;
+    config.quality = quality;
+    config.method = method;
+    config.thread_level = thread_level;
 
+    if (!WebPValidateConfig(&config))
+        return 0;
+
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture))
+        return 0;
+
+    picture.use_argb = lossless;
+    picture.width = w;
+    picture.height = h;
+
+    int ret = 0;
+
+    if (c == 3)
+    {
 #if _WIN32
-    fp = _wfopen(filepath, L"wb");
+        ret = WebPPictureImportBGR(&picture, pixeldata, w * 3);
 #else
-    fp = fopen(filepath, "wb");
+        ret = WebPPictureImportRGB(&picture, pixeldata, w * 3);
 #endif
-    if (!fp)
-        goto RETURN;
+    }
+    else
+    {
+#if _WIN32
+        ret = WebPPictureImportBGRA(&picture, pixeldata, w * 4);
+#else
+        ret = WebPPictureImportRGBA(&picture, pixeldata, w * 4);
+#endif
+    }
 
-    fwrite(output, 1, length, fp);
+    if (ret)
+    {
+        picture.writer = webp_write_to_vector;
+        picture.custom_ptr = &filedata;
+
+        ret = WebPEncode(&config, &picture);
+    }
 
-    ret = 1;
+    WebPPictureFree(&picture);
 
-RETURN:
-    if (output) WebPFree(output);
-    if (fp) fclose(fp);
+    if (!ret)
+        filedata.clear();
 
     return ret;
 }
@@ -0,0 +1,441 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+// chunks of output frames claimed by workers with lock files in a job directory on a shared filesystem
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <io.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// ncnn
+#include "platform.h"
+
+#include "filesystem_utils.h"
+
+// output frames per chunk
+#define WORK_CHUNK_FRAMES 64
+
+// seconds without a refresh after which a claim belongs to a crashed worker and the chunk is issued again
+#define WORK_CLAIM_TIMEOUT 120
+
+// seconds between refreshes of the claim being worked on
+#define WORK_HEARTBEAT_INTERVAL 10
+
+// seconds between scans while every remaining chunk is claimed by another worker
+#define WORK_POLL_INTERVAL 5
+
+class WorkQueue
+{
+public:
+    WorkQueue()
+    {
+        chunk_count = 0;
+        scan_begin = 0;
+        stopping = false;
+        heartbeat = 0;
+    }
+
+    ~WorkQueue()
+    {
+        close();
+    }
+
+    // every worker of the job opens the same directory, chunk_count must agree between them
+    int open(const path_t& _jobdir, int _chunk_count)
+    {
+        jobdir = _jobdir;
+        chunk_count = _chunk_count;
+        worker = worker_name();
+        worker_suffix = path_t(worker.begin(), worker.end());
+
+#if _WIN32
+        _wmkdir(jobdir.c_str());
+#else
+        mkdir(jobdir.c_str(), 0755);
+#endif
+
+        // the first worker publishes the chunk count, the others check theirs against it
+        const path_t countpath = jobdir + PATHSTR("/chunks");
+        const path_t tmppath = countpath + PATHSTR('.') + worker_suffix;
+        {
+            char buf[32];
+            sprintf(buf, "%d\n", chunk_count);
+            if (write_file(tmppath, buf, false) != 0)
+            {
+                fprintf(stderr, "create job directory failed\n");
+                return -1;
+            }
+
+            publish_file(tmppath, countpath);
+        }
+
+        std::vector<unsigned char> data;
+        if (read_file(countpath, data) != 0)
+        {
+            fprintf(stderr, "read job directory failed\n");
+            return -1;
+        }
+
+        data.push_back('\0');
+        if (atoi((const char*)data.data()) != chunk_count)
+        {
+            fprintf(stderr, "job directory belongs to a job with different frames\n");
+            return -1;
+        }
+
+        start_heartbeat();
+
+        return 0;
+    }
+
+    // gives the chunks still claimed back to the other workers
+    void close()
+    {
+        stop_heartbeat();
+
+        lock.lock();
+        std::vector<int> claimed = chunks;
+        lock.unlock();
+
+        for (size_t i = 0; i < claimed.size(); i++)
+        {
+            release(claimed[i]);
+        }
+    }
+
+    // claims the lowest chunk neither done nor claimed, takeover is set for a chunk of a crashed worker.
+    // returns -1 once every chunk is done. while the remaining chunks are claimed by others it waits,
+    // or returns -2 at once when wait is false
+    int claim(bool* takeover, bool wait)
+    {
+        for (;;)
+        {
+            bool remaining = false;
+
+            for (int i = scan_begin; i < chunk_count; i++)
+            {
+                if (filepath_is_readable(chunk_path(i, PATHSTR("done"))))
+                {
+                    // done chunks stay done, later scans start after them
+                    if (!remaining)
+                        scan_begin = i + 1;
+                    continue;
+                }
+
+                remaining = true;
+
+                if (try_claim(i, takeover))
+                {
+                    lock.lock();
+                    chunks.push_back(i);
+                    lock.unlock();
+
+                    return i;
+                }
+            }
+
+            if (!remaining)
+                return -1;
+
+            if (!wait)
+                return -2;
+
+            sleep_seconds(WORK_POLL_INTERVAL);
+        }
+    }
+
+    // the claimed chunk is complete, returns -1 when another worker has taken it over meanwhile
+    int complete(int chunk)
+    {
+        if (!drop(chunk) || !owns(chunk))
+            return -1;
+
+        write_file(chunk_path(chunk, PATHSTR("done")), worker.c_str(), false);
+        remove_file(chunk_path(chunk, PATHSTR("claim")));
+
+        return 0;
+    }
+
+    // gives the claimed chunk back to the other workers
+    void release(int chunk)
+    {
+        if (drop(chunk) && owns(chunk))
+            remove_file(chunk_path(chunk, PATHSTR("claim")));
+    }
+
+    // the claim of the chunk expired and another worker has taken it over
+    bool lost(int chunk) const
+    {
+        lock.lock();
+        const bool ret = std::find(lost_chunks.begin(), lost_chunks.end(), chunk) != lost_chunks.end();
+        lock.unlock();
+
+        return ret;
+    }
+
+private:
+    // the claim file still names this worker
+    bool owns(int chunk) const
+    {
+        std::vector<unsigned char> data;
+        if (read_file(chunk_path(chunk, PATHSTR("claim")), data) != 0)
+            return false;
+
+        return std::string(data.begin(), data.end()) == worker;
+    }
+
+    // forgets the chunk, false when it was not claimed or has been lost
+    bool drop(int chunk)
+    {
+        lock.lock();
+
+        bool claimed = false;
+        std::vector<int>::iterator it = std::find(chunks.begin(), chunks.end(), chunk);
+        if (it != chunks.end())
+        {
+            chunks.erase(it);
+            claimed = true;
+        }
+
+        it = std::find(lost_chunks.begin(), lost_chunks.end(), chunk);
+        if (it != lost_chunks.end())
+        {
+            lost_chunks.erase(it);
+            claimed = false;
+        }
+
+        lock.unlock();
+
+        return claimed;
+    }
+
+    bool try_claim(int i, bool* takeover)
+    {
+        const path_t claimpath = chunk_path(i, PATHSTR("claim"));
+
+        *takeover = false;
+
+        if (write_file(claimpath, worker.c_str(), true) == 0)
+            return true;
+
+        if (file_age(claimpath) < WORK_CLAIM_TIMEOUT)
+            return false;
+
+        // only one of the workers finding the claim expired moves it away
+        const path_t expiredpath = claimpath + PATHSTR(".expired.") + worker_suffix;
+        if (rename_file(claimpath, expiredpath) != 0)
+            return false;
+
+        if (file_age(expiredpath) < WORK_CLAIM_TIMEOUT)
+        {
+            // a new claim was made between the check and the rename, hand it back
+            publish_file(expiredpath, claimpath);
+            return false;
+        }
+
+        remove_file(expiredpath);
+
+        if (write_file(claimpath, worker.c_str(), true) != 0)
+            return false;
+
+        *takeover = true;
+        return true;
+    }
+
+    path_t chunk_path(int i, const path_t& suffix) const
+    {
+#if _WIN32
+        wchar_t name[64];
+        swprintf(name, 64, L"/chunk-%06d.", i);
+#else
+        char name[64];
+        sprintf(name, "/chunk-%06d.", i);
+#endif
+        return jobdir + name + suffix;
+    }
+
+    // exclusive fails when the file exists
+    static int write_file(const path_t& path, const char* content, bool exclusive)
+    {
+#if _WIN32
+        int fd = _wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | (exclusive ? _O_EXCL : 0), _S_IREAD | _S_IWRITE);
+        if (fd < 0)
+            return -1;
+
+        _write(fd, content, (unsigned int)strlen(content));
+        _close(fd);
+#else
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (exclusive ? O_EXCL : 0), 0644);
+        if (fd < 0)
+            return -1;
+
+        ssize_t n = ::write(fd, content, strlen(content));
+        (void)n;
+        ::close(fd);
+#endif
+        return 0;
+    }
+
+    // renames src to dst unless dst exists, src is removed either way
+    static void publish_file(const path_t& src, const path_t& dst)
+    {
+#if _WIN32
+        if (!MoveFileExW(src.c_str(), dst.c_str(), 0))
+            _wremove(src.c_str());
+#else
+        // link keeps an existing dst, filesystems without hard links get a plain rename
+        if (link(src.c_str(), dst.c_str()) != 0 && errno != EEXIST)
+        {
+            if (access(dst.c_str(), F_OK) != 0)
+                rename(src.c_str(), dst.c_str());
+        }
+        unlink(src.c_str());
+#endif
+    }
+
+    // seconds since the last refresh, 0 when the file is gone
+    static double file_age(const path_t& path)
+    {
+#if _WIN32
+        struct _stat64 st;
+        if (_wstat64(path.c_str(), &st) != 0)
+            return 0;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return 0;
+#endif
+        return difftime(time(NULL), st.st_mtime);
+    }
+
+    static void touch_file(const path_t& path)
+    {
+#if _WIN32
+        _wutime(path.c_str(), NULL);
+#else
+        utime(path.c_str(), NULL);
+#endif
+    }
+
+    static void sleep_seconds(int seconds)
+    {
+#if _WIN32
+        Sleep(seconds * 1000);
+#else
+        sleep(seconds);
+#endif
+    }
+
+    // unique between the machines sharing the job directory
+    static std::string worker_name()
+    {
+        char host[256] = "localhost";
+#if _WIN32
+        DWORD size = sizeof(host);
+        GetComputerNameA(host, &size);
+        const int pid = _getpid();
+#else
+        gethostname(host, sizeof(host) - 1);
+        const int pid = getpid();
+#endif
+        char name[300];
+        sprintf(name, "%s.%d", host, pid);
+
+        return name;
+    }
+
+    void start_heartbeat()
+    {
+        stopping = false;
+        heartbeat = new ncnn::Thread(heartbeat_worker, (void*)this);
+    }
+
+    void stop_heartbeat()
+    {
+        if (!heartbeat)
+            return;
+
+        lock.lock();
+        stopping = true;
+        lock.unlock();
+
+        heartbeat->join();
+        delete heartbeat;
+        heartbeat = 0;
+    }
+
+    // refreshes the claims of this worker, a claim naming another worker is lost and left alone
+    static void* heartbeat_worker(void* args)
+    {
+        WorkQueue* wq = (WorkQueue*)args;
+
+        for (int t = 1; ; t++)
+        {
+            sleep_seconds(1);
+
+            wq->lock.lock();
+            const bool stopping = wq->stopping;
+            std::vector<int> claimed = wq->chunks;
+            wq->lock.unlock();
+
+            if (stopping)
+                break;
+
+            if (t % WORK_HEARTBEAT_INTERVAL != 0)
+                continue;
+
+            for (size_t i = 0; i < claimed.size(); i++)
+            {
+                if (wq->owns(claimed[i]))
+                {
+                    touch_file(wq->chunk_path(claimed[i], PATHSTR("claim")));
+                    continue;
+                }
+
+                wq->lock.lock();
+                std::vector<int>::iterator it = std::find(wq->chunks.begin(), wq->chunks.end(), claimed[i]);
+                if (it != wq->chunks.end())
+                {
+                    wq->chunks.erase(it);
+                    wq->lost_chunks.push_back(claimed[i]);
+                }
+                wq->lock.unlock();
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    path_t jobdir;
+    std::string worker;
+    path_t worker_suffix;
+    int chunk_count;
+
+    // chunks before are done
+    int scan_begin;
+
+    mutable ncnn::Mutex lock;
+    std::vector<int> chunks;
+    std::vector<int> lost_chunks;
+    bool stopping;
+    ncnn::Thread* heartbeat;
+};
+
+#endif // WORK_QUEUE_H